@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# Copyright (C) 2018 Tomas Flouri
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as
+# published by the Free Software Foundation, either version 3 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+# Department of Genetics, Evolution and Environment,
+# University College London, Gower Street, London WC1E 6BT, United Kingdom
+
+# Time --summarize, --summarize --index, --combine and --map on synthetic
+# MCMC files generated by mcmcgen, and report wall time, throughput and peak
+# memory as measured by --stats-report.
+#
+# usage: bench.sh SUMMARIZER MCMCGEN
+#
+# environment:
+#   SCALES   scales to run among small, medium and large (default: small medium)
+#   THREADS  number of threads passed to summarizer (default: 1)
+#   BENCHDIR directory for generated files (default: bench-data)
+
+set -e
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 SUMMARIZER MCMCGEN" >&2
+  exit 1
+fi
+
+PROG=$1
+GEN=$2
+SCALES=${SCALES:-"small medium"}
+THREADS=${THREADS:-1}
+BENCHDIR=${BENCHDIR:-bench-data}
+
+mkdir -p "$BENCHDIR"
+
+# run a summarizer command and print one line of the results table
+run() {
+  name=$1
+  shift
+
+  report=$("$PROG" "$@" --threads "$THREADS" --quiet --stats-report json \
+           2>&1 >/dev/null | tail -n 1)
+
+  echo "$report" | sed -n 's/.*"total": {"wall": \([0-9.]*\),.*"peak_rss": \([0-9]*\)}, "bytes_read".*/\1 \2/p' |
+  awk -v scale="$scale" -v name="$name" -v bytes="$bytes" -v rows="$rows" '
+    NF == 2 {
+      wall = $1 > 0 ? $1 : 1e-6
+      printf "%-8s %-18s %10.3f %10.1f %12.0f %10.1f\n",
+             scale, name, $1, bytes/wall/1048576, rows/wall, $2/1048576
+      found = 1
+    }
+    END { if (!found) printf "%-8s %-18s failed\n", scale, name }'
+}
+
+printf "%-8s %-18s %10s %10s %12s %10s\n" \
+       "scale" "command" "wall (s)" "MB/s" "rows/s" "peak (MB)"
+
+for scale in $SCALES; do
+  # samples per chain, species, chains
+  case $scale in
+    small)  set -- 10000 20 4 ;;
+    medium) set -- 100000 50 4 ;;
+    large)  set -- 1000000 100 4 ;;
+    *) echo "Unknown scale $scale" >&2; exit 1 ;;
+  esac
+
+  prefix=$BENCHDIR/$scale
+  if [ ! -f "$prefix.txt" ]; then
+    "$GEN" -n "$1" -s "$2" -c "$3" -o "$prefix"
+  fi
+
+  bytes=$(wc -c < "$prefix.txt")
+  rows=$(($1 * $3))
+
+  run summarize --summarize "$prefix.txt" --output "$prefix.out"
+  run summarize-index --summarize "$prefix.txt" --index "$prefix.index" \
+                      --output "$prefix.out"
+  run combine --combine "$prefix.list" --output "$prefix.comb"
+  run map --map "$prefix.txt" --tree "$prefix.tree" --output "$prefix.nwk"
+done
@@ -0,0 +1,297 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+/* Generator of synthetic MCMCtree-like sample files for benchmarking.
+
+   A random rooted tree of S species is built by joining random pairs of
+   lineages, and written to PREFIX.tree with inner nodes labelled
+   S+1 (root) to 2S-1 as in MCMCtree. Each sample line holds the generation,
+   the node ages t_n(S+1) ... t_n(2S-1), the rate mu, sigma2 and the
+   log-likelihood lnL. Every column follows a stationary AR(1) process around
+   its mean with autocorrelation RHO, so that ESS is meaningful.
+
+   With C chains, each chain is written to PREFIX.N.txt and listed in
+   PREFIX.list (input of --combine and --list), and all chains are also
+   concatenated in PREFIX.txt with the number of samples of each chain in
+   PREFIX.index (input of --index). With a single chain only PREFIX.txt and
+   PREFIX.tree are written */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <math.h>
+
+#define EXTRA_COLUMNS 3
+
+static long opt_samples = 10000;
+static long opt_species = 20;
+static long opt_chains = 1;
+static double opt_rho = 0.9;
+static uint64_t opt_seed = 1;
+static char * opt_prefix = NULL;
+
+static uint64_t rng_state;
+
+static void fatal(const char * format, ...)
+{
+  va_list argptr;
+  va_start(argptr, format);
+  vfprintf(stderr, format, argptr);
+  va_end(argptr);
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+static void * xmalloc(size_t size)
+{
+  void * t = malloc(size);
+  if (!t)
+    fatal("Unable to allocate enough memory.");
+  return t;
+}
+
+static FILE * xopen(const char * filename, const char * mode)
+{
+  FILE * fp = fopen(filename, mode);
+  if (!fp)
+    fatal("Cannot open file %s", filename);
+  return fp;
+}
+
+/* xorshift64* generator, such that the output depends only on the seed */
+static double rng_uniform(void)
+{
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_normal(void)
+{
+  double u = rng_uniform();
+  double v = rng_uniform();
+
+  return sqrt(-2*log(1-u)) * cos(2*M_PI*v);
+}
+
+static void print_tree(FILE * fp, long node, long species, long * left,
+                       long * right)
+{
+  if (node < species)
+  {
+    fprintf(fp, "T%ld", node+1);
+    return;
+  }
+
+  fprintf(fp, "(");
+  print_tree(fp, left[node-species], species, left, right);
+  fprintf(fp, ",");
+  print_tree(fp, right[node-species], species, left, right);
+  fprintf(fp, ")%ld", 3*species-1-node);
+}
+
+/* build a random tree by joining random pairs of lineages. The j-th join
+   creates node species+j, and its age increases with j such that every
+   node is younger than its parent. Fills in the mean age of each inner
+   node, indexed by its label minus species+1 */
+static void make_tree(const char * filename, double * ages)
+{
+  long i,j;
+  long species = opt_species;
+  long * left = (long *)xmalloc((size_t)species * sizeof(long));
+  long * right = (long *)xmalloc((size_t)species * sizeof(long));
+  long * active = (long *)xmalloc((size_t)species * sizeof(long));
+  long active_count = species;
+
+  for (i = 0; i < species; ++i)
+    active[i] = i;
+
+  for (j = 0; j < species-1; ++j)
+  {
+    i = (long)(rng_uniform() * active_count);
+    left[j] = active[i];
+    active[i] = active[--active_count];
+
+    i = (long)(rng_uniform() * active_count);
+    right[j] = active[i];
+    active[i] = species+j;
+
+    /* node species+j is labelled 2*species-1-j, root is at 1.0 */
+    ages[species-2-j] = (j+1.0) / (species-1);
+  }
+
+  FILE * fp = xopen(filename, "w");
+  print_tree(fp, 2*species-2, species, left, right);
+  fprintf(fp, ";\n");
+  fclose(fp);
+
+  free(active);
+  free(right);
+  free(left);
+}
+
+static void write_header(FILE * fp)
+{
+  long i;
+
+  fprintf(fp, "Gen");
+  for (i = 0; i < opt_species-1; ++i)
+    fprintf(fp, "\tt_n%ld", opt_species+1+i);
+  fprintf(fp, "\tmu\tsigma2\tlnL\n");
+}
+
+/* write opt_samples lines of one chain to each of the given files */
+static void write_chain(FILE ** fp, long fp_count, const double * means,
+                        const double * sds, long col_count)
+{
+  long i,j,k;
+  double * e = (double *)xmalloc((size_t)col_count * sizeof(double));
+  char * line = (char *)xmalloc((size_t)(col_count+1) * 32);
+  double w = sqrt(1 - opt_rho*opt_rho);
+
+  /* start from the stationary distribution */
+  for (i = 0; i < col_count; ++i)
+    e[i] = rng_normal();
+
+  for (j = 0; j < opt_samples; ++j)
+  {
+    char * p = line;
+
+    p += sprintf(p, "%ld", (j+1)*10);
+    for (i = 0; i < col_count; ++i)
+    {
+      e[i] = opt_rho*e[i] + w*rng_normal();
+
+      /* lnL is printed with three decimals as in MCMCtree */
+      double x = means[i] + sds[i]*e[i];
+      p += sprintf(p, i == col_count-1 ? "\t%.3f" : "\t%.6f", x);
+    }
+    *p++ = '\n';
+
+    for (k = 0; k < fp_count; ++k)
+      fwrite(line, 1, (size_t)(p - line), fp[k]);
+  }
+
+  free(line);
+  free(e);
+}
+
+static void usage(const char * progname)
+{
+  fprintf(stderr,
+          "Usage: %s [OPTIONS] -o PREFIX\n\n"
+          "  -n INTEGER  samples per chain (default: 10000)\n"
+          "  -s INTEGER  number of species (default: 20)\n"
+          "  -c INTEGER  number of chains (default: 1)\n"
+          "  -r REAL     AR(1) autocorrelation in [0,1) (default: 0.9)\n"
+          "  -x INTEGER  random seed (default: 1)\n"
+          "  -o PREFIX   prefix of output files\n",
+          progname);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char * argv[])
+{
+  long i;
+  int c;
+  char * s;
+
+  while ((c = getopt(argc, argv, "n:s:c:r:x:o:")) != -1)
+  {
+    switch (c)
+    {
+      case 'n': opt_samples = atol(optarg); break;
+      case 's': opt_species = atol(optarg); break;
+      case 'c': opt_chains = atol(optarg); break;
+      case 'r': opt_rho = atof(optarg); break;
+      case 'x': opt_seed = strtoull(optarg, NULL, 10); break;
+      case 'o': opt_prefix = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (!opt_prefix || optind != argc)
+    usage(argv[0]);
+  if (opt_samples < 1 || opt_species < 2 || opt_chains < 1)
+    fatal("Samples and chains must be positive, species at least 2");
+  if (opt_rho < 0 || opt_rho >= 1)
+    fatal("Autocorrelation must be in [0,1)");
+
+  /* seed 0 is a fixed point of xorshift */
+  rng_state = opt_seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  long col_count = opt_species - 1 + EXTRA_COLUMNS;
+  double * means = (double *)xmalloc((size_t)col_count * sizeof(double));
+  double * sds = (double *)xmalloc((size_t)col_count * sizeof(double));
+
+  s = (char *)xmalloc(strlen(opt_prefix) + 32);
+
+  sprintf(s, "%s.tree", opt_prefix);
+  make_tree(s, means);
+
+  /* node ages vary by 5%, followed by mu, sigma2 and lnL */
+  for (i = 0; i < opt_species-1; ++i)
+    sds[i] = 0.05 * means[i];
+  means[i] = 1;       sds[i++] = 0.1;
+  means[i] = 0.5;     sds[i++] = 0.08;
+  means[i] = -10000;  sds[i++] = 12;
+
+  FILE * fp[2];
+  sprintf(s, "%s.txt", opt_prefix);
+  fp[0] = xopen(s, "w");
+  write_header(fp[0]);
+
+  if (opt_chains == 1)
+    write_chain(fp, 1, means, sds, col_count);
+  else
+  {
+    sprintf(s, "%s.index", opt_prefix);
+    FILE * fp_index = xopen(s, "w");
+    sprintf(s, "%s.list", opt_prefix);
+    FILE * fp_list = xopen(s, "w");
+
+    for (i = 0; i < opt_chains; ++i)
+    {
+      sprintf(s, "%s.%ld.txt", opt_prefix, i+1);
+      fp[1] = xopen(s, "w");
+      write_header(fp[1]);
+      write_chain(fp, 2, means, sds, col_count);
+      fclose(fp[1]);
+
+      fprintf(fp_list, "%s\n", s);
+      fprintf(fp_index, "%ld\n", opt_samples);
+    }
+
+    fclose(fp_list);
+    fclose(fp_index);
+  }
+
+  fclose(fp[0]);
+
+  free(s);
+  free(sds);
+  free(means);
+  return 0;
+}
@@ -0,0 +1,392 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Layout of a cache file:
+
+   offset               contents
+   0                    cache_header_t
+   labels_offset        col_count+1 zero-terminated labels (incl. generation)
+   index_offset         dataset_count 64-bit record counts
+   stats_offset         partial summaries only: mean, standard deviation and
+                        tint of each column, computed on the original order
+   data_offset          col_count columns of sample_count doubles, stored
+                        contiguously in original sample order, or sorted in
+                        partial summaries
+
+   data_offset is aligned to CACHE_ALIGN such that the columns can be used
+   directly from a memory-mapped file. A partial summary holds a single
+   dataset, and contains all the information needed to reproduce its
+   summary and to merge it with other partial summaries (see cmd_merge) */
+
+#define CACHE_MAGIC "SMZCACHE"
+#define CACHE_VERSION 2
+#define CACHE_ENDIAN 0x01020304
+#define CACHE_ALIGN 4096
+
+#define CACHE_KIND_SAMPLES 0
+#define CACHE_KIND_PARTIAL 1
+
+#define CACHE_STATS 3
+
+typedef struct cache_header_s
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;
+  uint32_t kind;
+  uint32_t reserved;
+  uint64_t col_count;
+  uint64_t sample_count;
+  uint64_t dataset_count;
+  uint64_t labels_offset;
+  uint64_t labels_size;
+  uint64_t index_offset;
+  uint64_t stats_offset;
+  uint64_t data_offset;
+} cache_header_t;
+
+static void xfwrite(const void * ptr, size_t size, FILE * fp, const char * s)
+{
+  if (size && fwrite(ptr, 1, size, fp) != size)
+    fatal("Unable to write to cache file %s", s);
+}
+
+static void xfpad(FILE * fp, uint64_t offset, uint64_t target, const char * s)
+{
+  for (; offset < target; ++offset)
+    if (fputc(0, fp) == EOF)
+      fatal("Unable to write to cache file %s", s);
+}
+
+static void write_file(const char * filename,
+                       const samples_t * samples,
+                       uint32_t kind,
+                       const colstats_t * stats)
+{
+  long i;
+  uint64_t offset;
+  cache_header_t hdr;
+  FILE * fp;
+
+  long dataset_count = samples->dataset_count;
+  const long * records = samples->dataset_records_count;
+
+  /* a partial summary is a single dataset */
+  if (kind == CACHE_KIND_PARTIAL)
+  {
+    dataset_count = 1;
+    records = &samples->sample_count;
+  }
+
+  memset(&hdr, 0, sizeof(cache_header_t));
+  memcpy(hdr.magic, CACHE_MAGIC, 8);
+  hdr.version = CACHE_VERSION;
+  hdr.endian = CACHE_ENDIAN;
+  hdr.kind = kind;
+  hdr.col_count = samples->col_count;
+  hdr.sample_count = samples->sample_count;
+  hdr.dataset_count = dataset_count;
+
+  hdr.labels_offset = sizeof(cache_header_t);
+  for (i = 0; i < samples->col_count+1; ++i)
+    hdr.labels_size += strlen(samples->labels[i]) + 1;
+
+  hdr.index_offset = hdr.labels_offset + hdr.labels_size;
+  hdr.index_offset = (hdr.index_offset + 7) & ~UINT64_C(7);
+
+  offset = hdr.index_offset + hdr.dataset_count * sizeof(uint64_t);
+  if (stats)
+  {
+    hdr.stats_offset = offset;
+    offset += hdr.col_count * CACHE_STATS * sizeof(double);
+  }
+  hdr.data_offset = (offset + CACHE_ALIGN - 1) & ~(uint64_t)(CACHE_ALIGN-1);
+
+  if (kind == CACHE_KIND_PARTIAL)
+    printf("Writing partial summary %s...\n", filename);
+  else
+    printf("Writing cache file %s...\n", filename);
+
+  fp = xopen(filename, "wb");
+
+  xfwrite(&hdr, sizeof(cache_header_t), fp, filename);
+  offset = sizeof(cache_header_t);
+
+  for (i = 0; i < samples->col_count+1; ++i)
+    xfwrite(samples->labels[i], strlen(samples->labels[i])+1, fp, filename);
+  offset += hdr.labels_size;
+
+  xfpad(fp, offset, hdr.index_offset, filename);
+  offset = hdr.index_offset;
+
+  for (i = 0; i < dataset_count; ++i)
+  {
+    uint64_t count = records[i];
+    xfwrite(&count, sizeof(uint64_t), fp, filename);
+  }
+  offset += hdr.dataset_count * sizeof(uint64_t);
+
+  if (stats)
+  {
+    for (i = 0; i < samples->col_count; ++i)
+    {
+      double x[CACHE_STATS] = { stats[i].mean, stats[i].stdev, stats[i].tint };
+      xfwrite(x, sizeof(x), fp, filename);
+    }
+    offset += hdr.col_count * CACHE_STATS * sizeof(double);
+  }
+
+  xfpad(fp, offset, hdr.data_offset, filename);
+
+  for (i = 0; i < samples->col_count; ++i)
+    xfwrite(samples->matrix[i],
+            (size_t)samples->sample_count * sizeof(double),
+            fp,
+            filename);
+
+  if (fclose(fp))
+    fatal("Unable to write to cache file %s", filename);
+}
+
+void cache_write(const char * filename, const samples_t * samples)
+{
+  write_file(filename, samples, CACHE_KIND_SAMPLES, NULL);
+}
+
+/* write a partial summary of a single dataset, given its statistics and
+   the columns sorted by stats_compute */
+void cache_write_partial(const char * filename,
+                         const samples_t * samples,
+                         const colstats_t * stats)
+{
+  write_file(filename, samples, CACHE_KIND_PARTIAL, stats);
+}
+
+/* check magic, endianness, version and kind of a cache header */
+static void cache_check_header(const char * filename,
+                               const cache_header_t * hdr,
+                               uint32_t kind)
+{
+  if (memcmp(hdr->magic, CACHE_MAGIC, 8))
+    fatal("File %s is not a summarizer cache file", filename);
+
+  if (hdr->endian != CACHE_ENDIAN)
+    fatal("Cache file %s was written on a machine with different endianness",
+          filename);
+
+  if (hdr->version != CACHE_VERSION)
+    fatal("Cache file %s has unsupported version %u (expected %d)",
+          filename, hdr->version, CACHE_VERSION);
+
+  if (hdr->kind != kind)
+  {
+    if (kind == CACHE_KIND_PARTIAL)
+      fatal("File %s is a cache file and not a partial summary", filename);
+    else
+      fatal("File %s is a partial summary and not a cache file", filename);
+  }
+}
+
+static const cache_header_t * cache_check(const char * filename,
+                                          const char * data,
+                                          size_t size,
+                                          uint32_t kind)
+{
+  const cache_header_t * hdr = (const cache_header_t *)data;
+
+  if (size < sizeof(cache_header_t))
+    fatal("File %s is not a summarizer cache file", filename);
+
+  cache_check_header(filename, hdr, kind);
+
+  /* offsets and counts are taken from the file, hence regions are checked
+     in order of their offsets, and counts are bounded by dividing the
+     available space instead of multiplying, which could wrap around */
+  if (hdr->data_offset > size ||
+      hdr->data_offset % CACHE_ALIGN ||
+      hdr->index_offset > hdr->data_offset ||
+      hdr->labels_offset > hdr->index_offset ||
+      hdr->labels_size > hdr->index_offset - hdr->labels_offset ||
+      hdr->dataset_count > (hdr->data_offset - hdr->index_offset) /
+                           sizeof(uint64_t))
+    fatal("Cache file %s is truncated or corrupt", filename);
+
+  /* each of the col_count+1 labels takes at least one byte */
+  if (hdr->col_count >= hdr->labels_size)
+    fatal("Cache file %s is truncated or corrupt", filename);
+
+  uint64_t max_values = (size - hdr->data_offset) / sizeof(double);
+  if (hdr->col_count && hdr->sample_count > max_values / hdr->col_count)
+    fatal("Cache file %s is truncated or corrupt", filename);
+
+  if (kind == CACHE_KIND_PARTIAL &&
+      (hdr->dataset_count != 1 ||
+       hdr->stats_offset > hdr->data_offset ||
+       hdr->stats_offset < hdr->index_offset + sizeof(uint64_t) ||
+       hdr->col_count > (hdr->data_offset - hdr->stats_offset) /
+                        (CACHE_STATS*sizeof(double))))
+    fatal("Cache file %s is truncated or corrupt", filename);
+
+  return hdr;
+}
+
+long cache_dataset_count(const char * filename)
+{
+  cache_header_t hdr;
+
+  FILE * fp = xopen(filename, "rb");
+  if (fread(&hdr, sizeof(cache_header_t), 1, fp) != 1)
+    fatal("File %s is not a summarizer cache file", filename);
+  fclose(fp);
+
+  cache_check_header(filename, &hdr, CACHE_KIND_SAMPLES);
+
+  return (long)hdr.dataset_count;
+}
+
+static samples_t * map_file(const char * filename,
+                            uint32_t kind,
+                            const cache_header_t ** header)
+{
+  long i;
+  struct stat st;
+  char * data;
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    fatal("Cannot open file %s", filename);
+
+  if (fstat(fd, &st) == -1)
+    fatal("Cannot stat file %s", filename);
+
+  if (!st.st_size)
+    fatal("File %s is not a summarizer cache file", filename);
+
+  /* map privately with write access, such that columns can be sorted in
+     place without modifying the cache file */
+  data = (char *)mmap(NULL,
+                      (size_t)st.st_size,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE,
+                      fd,
+                      0);
+  if (data == MAP_FAILED)
+    fatal("Cannot map file %s into memory", filename);
+  close(fd);
+
+  const cache_header_t * hdr = cache_check(filename, data, st.st_size, kind);
+
+  samples_t * samples = (samples_t *)xcalloc(1,sizeof(samples_t));
+  samples->col_count = (long)hdr->col_count;
+  samples->sample_count = (long)hdr->sample_count;
+  samples->dataset_count = (long)hdr->dataset_count;
+  samples->cache_data = data;
+  samples->cache_size = (size_t)st.st_size;
+
+  /* labels */
+  const char * p = data + hdr->labels_offset;
+  const char * end = p + hdr->labels_size;
+  samples->labels = (char **)xmalloc((size_t)(samples->col_count+1) *
+                                     sizeof(char *));
+  for (i = 0; i < samples->col_count+1; ++i)
+  {
+    const char * z = (const char *)memchr(p, 0, end - p);
+    if (!z)
+      fatal("Cache file %s is truncated or corrupt", filename);
+    samples->labels[i] = xstrdup(p);
+    p = z+1;
+  }
+
+  /* per-dataset record counts */
+  if (samples->dataset_count)
+  {
+    const uint64_t * index = (const uint64_t *)(data + hdr->index_offset);
+    long total = 0;
+
+    samples->dataset_records_count = (long *)xmalloc(
+                                       (size_t)samples->dataset_count *
+                                       sizeof(long));
+    for (i = 0; i < samples->dataset_count; ++i)
+    {
+      if (index[i] > hdr->sample_count - (uint64_t)total)
+        fatal("Cache file %s is truncated or corrupt", filename);
+
+      samples->dataset_records_count[i] = (long)index[i];
+      total += (long)index[i];
+    }
+
+    if (total != samples->sample_count)
+      fatal("Cache file %s is truncated or corrupt", filename);
+  }
+
+  /* columns point directly into the mapped file */
+  double * column = (double *)(data + hdr->data_offset);
+  samples->matrix = (double **)xmalloc((size_t)samples->col_count *
+                                       sizeof(double *));
+  for (i = 0; i < samples->col_count; ++i)
+    samples->matrix[i] = column + i*samples->sample_count;
+
+  madvise(column,
+          (size_t)samples->col_count*samples->sample_count*sizeof(double),
+          MADV_WILLNEED);
+
+  *header = hdr;
+  return samples;
+}
+
+samples_t * cache_load(const char * filename)
+{
+  const cache_header_t * hdr;
+  samples_t * samples = map_file(filename, CACHE_KIND_SAMPLES, &hdr);
+
+  printf("Loaded %ld samples each %ld columns from cache %s\n",
+         samples->sample_count, samples->col_count, filename);
+
+  return samples;
+}
+
+/* load a partial summary. The columns are sorted, and the mean, standard
+   deviation and tint of each column are returned in stats */
+samples_t * cache_load_partial(const char * filename, colstats_t ** stats)
+{
+  long i;
+  const cache_header_t * hdr;
+  samples_t * samples = map_file(filename, CACHE_KIND_PARTIAL, &hdr);
+
+  const double * x = (const double *)((const char *)samples->cache_data +
+                                      hdr->stats_offset);
+
+  *stats = (colstats_t *)xcalloc((size_t)samples->col_count,
+                                 sizeof(colstats_t));
+  for (i = 0; i < samples->col_count; ++i, x += CACHE_STATS)
+  {
+    (*stats)[i].mean = x[0];
+    (*stats)[i].stdev = x[1];
+    (*stats)[i].tint = x[2];
+  }
+
+  printf("Loaded partial summary of %ld samples each %ld columns from %s\n",
+         samples->sample_count, samples->col_count, filename);
+
+  return samples;
+}
@@ -21,309 +21,448 @@
 
 #include "summarizer.h"
 
-#if 0
-static char buffer[LINEALLOC];
-static char * line = NULL;
-static size_t line_size = 0;
-static size_t line_maxsize = 0;
+/* Files are processed in parallel by the threads of the pool, while a
+   separate writer thread emits their rows in list order. Each file produces
+   a queue of blocks holding its rows without sample numbers, which are
+   inserted by the writer since they depend on the number of rows in all
+   preceding files. The number of queued blocks per file is bounded, hence
+   memory usage does not depend on the size of the files */
 
-static long get_long(const char * line, long * value)
+#define COMBINE_BUFSIZE (4*1024*1024)
+#define COMBINE_MAXBLOCKS 4
+
+typedef struct block_s
 {
-  int ret,len=0;
-  size_t ws;
-  char * s = xstrdup(line);
-  char * p = s;
+  char * data;
+  size_t size;
+  size_t maxsize;
+  struct block_s * next;
+} block_t;
 
-  /* skip all white-space */
-  ws = strspn(p, " \t\r\n");
+typedef struct combine_file_s
+{
+  char * filename;
 
-  /* is it a blank line or comment ? */
-  if (!p[ws] || p[ws] == '*' || p[ws] == '#')
-  {
-    free(s);
-    return 0;
-  }
+  /* queue of blocks produced and not yet written */
+  block_t * head;
+  block_t * tail;
+  long queued;
+  int done;
 
-  /* store address of value's beginning */
-  char * start = p+ws;
+  /* header line, set once started */
+  char * header;
+  int started;
 
-  /* skip all characters except star, hash and whitespace */
-  char * end = start + strcspn(start," \t\r\n*#");
+  /* errors are reported by the writer, in list order */
+  int empty;
+  long col_count;
+  long error_line;
+} combine_file_t;
 
-  *end = 0;
+typedef struct combine_job_s
+{
+  combine_file_t * files;
+  long file_count;
+  long col_count;
+  FILE * fp_out;
+  FILE * fp_index;
 
-  ret = sscanf(start, "%ld%n", value, &len);
-  if ((ret == 0) || (((unsigned int)(len)) < strlen(start)))
-  {
-    free(s);
-    return 0;
-  }
+  pthread_mutex_t mutex;
+  pthread_cond_t produced;
+  pthread_cond_t consumed;
+} combine_job_t;
 
-  free(s);
-  return ws + end - start;
+static block_t * block_create(void)
+{
+  block_t * block = (block_t *)xmalloc(sizeof(block_t));
+
+  block->maxsize = COMBINE_BUFSIZE;
+  block->data = (char *)xmalloc(block->maxsize);
+  block->size = 0;
+  block->next = NULL;
+
+  return block;
 }
 
-static long get_double(const char * line, double * value)
+static void block_reserve(block_t * block, size_t len)
 {
-  int ret,len=0;
-  size_t ws;
-  char * s = xstrdup(line);
-  char * p = s;
+  if (block->size + len <= block->maxsize) return;
 
-  /* skip all white-space */
-  ws = strspn(p, " \t\r\n");
+  while (block->size + len > block->maxsize)
+    block->maxsize *= 2;
+  block->data = (char *)xrealloc(block->data, block->maxsize);
+}
 
-  /* is it a blank line or comment ? */
-  if (!p[ws] || p[ws] == '*' || p[ws] == '#')
-  {
-    free(s);
-    return 0;
-  }
+static void block_write(block_t * block, const char * s, size_t len)
+{
+  block_reserve(block, len);
+  memcpy(block->data + block->size, s, len);
+  block->size += len;
+}
 
-  /* store address of value's beginning */
-  char * start = p+ws;
+/* append row to block without its sample number. The columns are only
+   delimited and copied verbatim */
+static int copy_row(block_t * block,
+                    const char * row,
+                    const char * end,
+                    long col_count)
+{
+  long i;
+  long count;
+  long sample_num;
+  const char * p = row;
+  const char * q;
 
-  /* skip all characters except star, hash and whitespace */
-  char * end = start + strcspn(start," \t\r\n*#");
+  /* skip sample number */
+  count = token_long(p,end,&sample_num);
+  if (!count) return 0;
 
-  *end = 0;
+  p += count;
 
-  ret = sscanf(start, "%lf%n", value, &len);
-  if ((ret == 0) || (((unsigned int)(len)) < strlen(start)))
+  /* locate the end of the last column; any further text is dropped */
+  for (i = 0, q = p; i < col_count; ++i)
   {
-    free(s);
-    return 0;
+    count = token_skip(q,end);
+    if (!count) return 0;
+
+    q += count;
   }
 
-  free(s);
-  return ws + end - start;
+  block_reserve(block, (size_t)(q-p) + 1);
+  memcpy(block->data + block->size, p, (size_t)(q-p));
+  block->size += q-p;
+  block->data[block->size++] = '\n';
+
+  return 1;
 }
 
-static long get_string(const char * line, char ** value)
+/* append row to block without its sample number, parsing every value and
+   printing it back with the same number of decimal places */
+static int reformat_row(block_t * block,
+                        const char * row,
+                        const char * end,
+                        long col_count)
 {
-  size_t ws;
-  char * s = xstrdup(line);
-  char * p = s;
+  long i;
+  long count;
+  long sample_num;
+  double x;
+  const char * p = row;
 
-  /* skip all white-space */
-  ws = strspn(p, " \t\r\n");
+  /* skip sample number */
+  count = token_long(p,end,&sample_num);
+  if (!count) return 0;
 
+  p += count;
 
-  /* is it a blank line or comment ? */
-  if (!p[ws] || p[ws] == '*' || p[ws] == '#')
+  /* read remaining elements of current row */
+  for (i = 0; i < col_count; ++i)
   {
-    free(s);
-    return 0;
-  }
+    int decplaces = 0;
+    count = token_double(p,end,&x, &decplaces);
+    if (!count) return 0;
 
-  /* store address of value's beginning */
-  char * start = p+ws;
+    p += count;
 
-  /* skip all characters except whitespace star and hash */
-  char * end = start + strcspn(start, " \t\r\n*#");
+    size_t avail = block->maxsize - block->size;
+    int len = snprintf(block->data + block->size, avail, "\t%.*f", decplaces,x);
+    if ((size_t)len >= avail)
+    {
+      block_reserve(block, (size_t)len + 1);
+      snprintf(block->data + block->size, (size_t)len + 1, "\t%.*f",
+               decplaces, x);
+    }
+    block->size += len;
+  }
 
-  if (start == end) return 0;
+  block_write(block, "\n", 1);
 
-  *end = 0;
+  return 1;
+}
 
-  *value = xstrdup(start);
-  free(s);
+/* hand over a block to the writer, waiting while the queue is full */
+static void queue_push(combine_job_t * job, combine_file_t * file,
+                       block_t * block)
+{
+  pthread_mutex_lock(&job->mutex);
+  while (file->queued == COMBINE_MAXBLOCKS)
+    pthread_cond_wait(&job->consumed, &job->mutex);
+
+  if (file->tail)
+    file->tail->next = block;
+  else
+    file->head = block;
+  file->tail = block;
+  file->queued++;
+
+  pthread_cond_broadcast(&job->produced);
+  pthread_mutex_unlock(&job->mutex);
+}
 
-  return ws + end - start;
+/* wait until the header of file has been read */
+static void queue_wait_header(combine_job_t * job, combine_file_t * file)
+{
+  pthread_mutex_lock(&job->mutex);
+  while (!file->started)
+    pthread_cond_wait(&job->produced, &job->mutex);
+  pthread_mutex_unlock(&job->mutex);
 }
 
-static void reallocline(size_t newmaxsize)
+/* next block of file, or NULL once the file is completely processed */
+static block_t * queue_pop(combine_job_t * job, combine_file_t * file)
 {
-  char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
+  block_t * block;
+
+  pthread_mutex_lock(&job->mutex);
+  while (!file->head && !file->done)
+    pthread_cond_wait(&job->produced, &job->mutex);
 
-  if (line)
+  block = file->head;
+  if (block)
   {
-    memcpy(temp,line,line_size*sizeof(char));
-    free(line);
+    file->head = block->next;
+    if (!file->head)
+      file->tail = NULL;
+    file->queued--;
+
+    pthread_cond_broadcast(&job->consumed);
   }
-  line = temp;
-  line_maxsize = newmaxsize;
+  pthread_mutex_unlock(&job->mutex);
+
+  return block;
 }
 
-static char * getnextline(FILE * fp)
+static void cb_combine_file(long index, void * data)
 {
-  size_t len = 0;
-
-  line_size = 0;
-
-  /* read from file until newline or eof */
-  while (fgets(buffer, LINEALLOC, fp))
+  combine_job_t * job = (combine_job_t *)data;
+  combine_file_t * file = job->files + index;
+  size_t len;
+  const char * row;
+
+  reader_t * rd = reader_open(file->filename);
+
+  /* each file is read exactly once, such that pipes can be combined. Its
+     header is handed over to the writer, which checks the number of
+     columns against the first file */
+  row = reader_nextline(rd,&len);
+
+  pthread_mutex_lock(&job->mutex);
+  if (!row)
+    file->empty = 1;
+  else
   {
-    len = strlen(buffer);
+    file->header = xstrndup(row,len);
 
-    if (line_size + len > line_maxsize)
-      reallocline(line_maxsize + LINEALLOC);
+    /* substract generations */
+    file->col_count = count_columns(file->header) - 1;
+  }
+  file->started = 1;
+  pthread_cond_broadcast(&job->produced);
+  pthread_mutex_unlock(&job->mutex);
 
-    memcpy(line+line_size,buffer,len*sizeof(char));
-    line_size += len;
+  if (!file->empty)
+  {
+    block_t * block = block_create();
 
-    if (buffer[len-1] == '\n')
+    /* by default rows are copied verbatim except for the sample number,
+       while with --validate each value is parsed and printed back */
+    while ((row=reader_nextline(rd,&len)))
     {
-      #if 0
-      if (line_size+1 > line_maxsize)
-        reallocline(line_maxsize+1);
+      int ok;
 
-      line[line_size] = 0;
-      #else
-        line[line_size-1] = 0;
-      #endif
+      if (opt_validate)
+        ok = reformat_row(block, row, row+len, file->col_count);
+      else
+        ok = copy_row(block, row, row+len, file->col_count);
 
-      return line;
+      if (!ok)
+      {
+        file->error_line = rd->lineno;
+        break;
+      }
+
+      if (block->size >= COMBINE_BUFSIZE)
+      {
+        queue_push(job, file, block);
+        block = block_create();
+      }
     }
-  }
 
-  if (!line_size)
-  {
-    free(line);
-    line_maxsize = 0;
-    line = NULL;
-    return NULL;
+    if (block->size)
+      queue_push(job, file, block);
+    else
+    {
+      free(block->data);
+      free(block);
+    }
   }
 
-  if (line_size == line_maxsize)
-    reallocline(line_maxsize+1);
+  reader_close(rd);
 
-  line[line_size] = 0;
-  return line;
+  pthread_mutex_lock(&job->mutex);
+  file->done = 1;
+  pthread_cond_broadcast(&job->produced);
+  pthread_mutex_unlock(&job->mutex);
 }
 
-static long count_columns(const char * line)
+/* write the rows of all files in list order, numbering them consecutively,
+   and write the number of rows of each file in the index file */
+static void * combine_writer(void * arg)
 {
-  long columns = 0;
-  char * s = xstrdup(line);
-  char * p = s;
-  char * tmp;
-  size_t count = 0;
-  size_t ws;
+  long i;
+  long line_count = 1;
+  block_t * block;
+  combine_job_t * job = (combine_job_t *)arg;
+  outbuf_t buf;
 
+  outbuf_init(&buf, job->fp_out, opt_output, COMBINE_BUFSIZE);
 
-  while (1)
+  for (i = 0; i < job->file_count; ++i)
   {
-    count = get_string(p, &tmp);
-    if (!count) break;
+    combine_file_t * file = job->files + i;
+    long file_line_count = 0;
 
-    p += count;
+    fprintf(stdout, "Processing file %s\n", file->filename);
 
-    columns++;
-    free(tmp);
+    queue_wait_header(job, file);
 
-    ws = strspn(p, " \t\r\n");
-    if (!ws) break;
+    /* the header of the first file is written to the output, and its
+       number of columns is expected in all files */
+    if (!i && !file->empty)
+    {
+      job->col_count = file->col_count;
+      outbuf_string(&buf, file->header);
+      outbuf_write(&buf, "\n", 1);
+    }
+
+    /* rows up to an error are written, as in a sequential run */
+    if (file->empty || file->col_count != job->col_count)
+      outbuf_flush(&buf);
+
+    if (file->empty)
+      fatal("File %s is empty", file->filename);
+    if (file->col_count != job->col_count)
+      fatal("File %s contains %ld columns instead of %ld",
+            file->filename, file->col_count+1, job->col_count+1);
+
+    while ((block = queue_pop(job, file)))
+    {
+      const char * p = block->data;
+      const char * end = block->data + block->size;
 
-    p += ws;
+      while (p < end)
+      {
+        const char * eol = (const char *)memchr(p, '\n', end - p);
+
+        outbuf_long(&buf, line_count++);
+        outbuf_write(&buf, p, (size_t)(eol - p) + 1);
+        file_line_count++;
+
+        p = eol+1;
+      }
+
+      free(block->data);
+      free(block);
+    }
+
+    if (file->error_line >= 0)
+    {
+      outbuf_flush(&buf);
+      fatal("Invalid entry in line %ld of %s",
+            file->error_line, file->filename);
+    }
+
+    fprintf(job->fp_index,"%ld\n",file_line_count);
   }
 
-  free(s);
-  return columns;
+  outbuf_free(&buf);
+
+  return NULL;
 }
-#endif
 
 void cmd_combine()
 {
   long i;
-  long first = 1;
-  long col_count = 0;
-  long count;
-  long sample_num;
-  long line_count = 1;
-  long file_line_count = 0;
+  long maxcount = 16;
   char * line;
-  FILE * fp_list;
-  FILE * fp_in;
-  FILE * fp_out;
-  FILE * fp_index;
+  reader_t * rd;
+  pthread_t writer;
+  combine_job_t job;
 
   if (opt_skipcount != 1)
     fatal("Option --skip must be set to 1 when --combine");
 
-  fp_list = xopen(opt_combine,"r");
+  rd = reader_open(opt_combine);
 
   if (!opt_output)
     fatal("Option --combine requires an output file via --output");
 
-  fp_out = xopen(opt_output,"w");
+  memset(&job, 0, sizeof(combine_job_t));
+
+  job.fp_out = xopen(opt_output,"w");
 
   char * s = NULL;
   xasprintf(&s, "%s.index", opt_output);
-  fp_index = xopen(s,"w");
+  job.fp_index = xopen(s,"w");
   free(s);
 
-  while ((line=getnextline(fp_list)))
+  job.files = (combine_file_t *)xmalloc((size_t)maxcount *
+                                        sizeof(combine_file_t));
+  while ((line=reader_getline(rd)))
   {
-    file_line_count = 0;
-    char * filename = xstrdup(line);
-    for (i = 0; i < strlen(filename); ++i)
-      if (filename[i] == '\r' || filename[i] == '\n')
-        filename[i] = 0;
-    fp_in = xopen(filename,"r");
-
-    fprintf(stdout, "Processing file %s\n", filename);
-
-    line = getnextline(fp_in);
-
-    /* if it was the first file */
-    if (first)
+    if (job.file_count == maxcount)
     {
-      col_count = count_columns(line);
-
-      /* substract generations */
-      col_count--;
-
-      fprintf(fp_out,"%s\n",line);
+      maxcount *= 2;
+      job.files = (combine_file_t *)xrealloc(job.files,
+                                             (size_t)maxcount *
+                                             sizeof(combine_file_t));
     }
-    else
-    {
-      long temp_col_count = count_columns(line);
-      if (temp_col_count-1 != col_count)
-        fatal("File %s contains %ld columns instead of %ld\n",
-              temp_col_count, col_count+1);
-    }
-
-    /* we finished with the first file */
-    if (first) first = 0;
-
-    while ((line=getnextline(fp_in)))
-    {
-      double x;
-      char * p = line;
 
-      /* skip sample number */
-      count = get_long(p,&sample_num);
-      if (!count) goto l_unwind;
+    combine_file_t * file = job.files + job.file_count++;
+    memset(file, 0, sizeof(combine_file_t));
+    file->filename = xstrdup(line);
+    file->filename[strcspn(file->filename,"\r\n")] = 0;
+    file->error_line = -1;
 
-      p += count;
+    /* fail early on files that cannot be read. The files are not opened,
+       as named pipes can be read only once */
+    if (access(file->filename, R_OK) == -1)
+      fatal("Cannot open file %s", file->filename);
+  }
+  reader_close(rd);
 
-      fprintf(fp_out, "%ld", line_count);
-      /* read remaining elements of current row */
+  if (!job.file_count)
+  {
+    free(job.files);
+    fclose(job.fp_out);
+    fclose(job.fp_index);
+    return;
+  }
 
-      for (i = 0; i < col_count; ++i)
-      {
-        int decplaces = 0;
-        count = get_double(p,&x, &decplaces);
-        if (!count) goto l_unwind;
+  pthread_mutex_init(&job.mutex, NULL);
+  pthread_cond_init(&job.produced, NULL);
+  pthread_cond_init(&job.consumed, NULL);
 
-        p += count;
+  if (pthread_create(&writer, NULL, combine_writer, &job))
+    fatal("Unable to create thread");
 
-        fprintf(fp_out, "\t%.*f", decplaces,x);
-      }
+  threadpool_run(job.file_count, cb_combine_file, &job);
 
-      line_count++;
-      file_line_count++;
-      fprintf(fp_out, "\n");
-    }
+  if (pthread_join(writer, NULL))
+    fatal("Unable to join thread");
 
-    free(filename);
-    fclose(fp_in);
+  pthread_cond_destroy(&job.consumed);
+  pthread_cond_destroy(&job.produced);
+  pthread_mutex_destroy(&job.mutex);
 
-    fprintf(fp_index,"%ld\n",file_line_count);
+  for (i = 0; i < job.file_count; ++i)
+  {
+    free(job.files[i].header);
+    free(job.files[i].filename);
   }
-l_unwind:
-  fclose(fp_list);    
-  fclose(fp_out);
-  fclose(fp_index);
+  free(job.files);
+
+  if (fclose(job.fp_out))
+    fatal("Unable to write to file %s", opt_output);
+  fclose(job.fp_index);
 }
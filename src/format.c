@@ -0,0 +1,713 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Machine-readable summaries, holding one record per column with the
+   statistics named in stat_names. The record of each column is written in
+   a single pass through an output buffer. Text formats are CSV and TSV with
+   a header line, and JSON of the form
+
+     {"samples": N, "columns": [{"label": "t_n7", "mean": ..., ...}, ...]}
+
+   Statistics that are not available, such as ESS in approximate summaries,
+   are written as empty fields in CSV and TSV, and as null in JSON.
+
+   Layout of a binary summary:
+
+   offset               contents
+   0                    format_header_t
+   labels_offset        col_count zero-terminated labels
+   stats_offset         col_count records of stat_count doubles, in the order
+                        of stat_names, with NaN for unavailable statistics
+
+   stats_offset is aligned to 8 bytes */
+
+#define FORMAT_MAGIC "SMZSTATS"
+#define FORMAT_VERSION 1
+#define FORMAT_ENDIAN 0x01020304
+
+#define FORMAT_STATS 11
+
+typedef struct format_header_s
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;
+  uint64_t col_count;
+  uint64_t sample_count;
+  uint64_t stat_count;
+  uint64_t labels_offset;
+  uint64_t labels_size;
+  uint64_t stats_offset;
+} format_header_t;
+
+static const char * stat_names[FORMAT_STATS] =
+ {
+   "mean", "median", "stdev", "min", "max", "q025", "q975", "hpd025",
+   "hpd975", "ess", "eff"
+ };
+
+static const char * format_names[] = { "text", "csv", "tsv", "json", "bin" };
+
+/* parse the argument of --format */
+long format_parse(const char * s)
+{
+  long i;
+
+  for (i = 0; i < (long)(sizeof(format_names)/sizeof(char *)); ++i)
+    if (!strcmp(s, format_names[i]))
+      return i;
+
+  fatal("Unknown output format %s (expected text, csv, tsv, json or bin)", s);
+}
+
+/* file name extension of summaries written in format */
+const char * format_extension(long format)
+{
+  return format == FORMAT_TEXT ? "txt" : format_names[format];
+}
+
+static void stats_values(const colstats_t * st, long records, int ess,
+                         double * x)
+{
+  x[0] = st->mean;
+  x[1] = st->median;
+  x[2] = st->stdev;
+  x[3] = st->min;
+  x[4] = st->max;
+  x[5] = st->q025;
+  x[6] = st->q975;
+  x[7] = st->hpd025;
+  x[8] = st->hpd975;
+  x[9] = ess ? records / st->tint : NAN;
+  x[10] = ess ? 1 / st->tint : NAN;
+}
+
+static void stats_from_values(const double * x, colstats_t * st)
+{
+  st->mean = x[0];
+  st->median = x[1];
+  st->stdev = x[2];
+  st->min = x[3];
+  st->max = x[4];
+  st->q025 = x[5];
+  st->q975 = x[6];
+  st->hpd025 = x[7];
+  st->hpd975 = x[8];
+  st->tint = x[10] > 0 ? 1 / x[10] : 0;
+}
+
+/* write a label as CSV/TSV field, quoted if it contains special characters */
+static void write_field(outbuf_t * buf, const char * s, char delim)
+{
+  if (!strchr(s, delim) && !strchr(s, '"') && !strchr(s, '\n'))
+  {
+    outbuf_string(buf, s);
+    return;
+  }
+
+  outbuf_write(buf, "\"", 1);
+  for (; *s; ++s)
+  {
+    if (*s == '"')
+      outbuf_write(buf, "\"", 1);
+    outbuf_write(buf, s, 1);
+  }
+  outbuf_write(buf, "\"", 1);
+}
+
+static void write_json_string(outbuf_t * buf, const char * s)
+{
+  outbuf_write(buf, "\"", 1);
+  for (; *s; ++s)
+  {
+    if (*s == '"' || *s == '\\')
+    {
+      outbuf_write(buf, "\\", 1);
+      outbuf_write(buf, s, 1);
+    }
+    else if ((unsigned char)*s < 0x20)
+      outbuf_printf(buf, "\\u%04x", (unsigned char)*s);
+    else
+      outbuf_write(buf, s, 1);
+  }
+  outbuf_write(buf, "\"", 1);
+}
+
+static void write_delimited(outbuf_t * buf,
+                            char ** labels,
+                            const colstats_t * stats,
+                            long col_count,
+                            long records,
+                            int ess,
+                            char delim)
+{
+  long i,j;
+  double x[FORMAT_STATS];
+
+  outbuf_string(buf, "label");
+  for (j = 0; j < FORMAT_STATS; ++j)
+  {
+    outbuf_write(buf, &delim, 1);
+    outbuf_string(buf, stat_names[j]);
+  }
+  outbuf_write(buf, "\n", 1);
+
+  for (i = 0; i < col_count; ++i)
+  {
+    stats_values(stats+i, records, ess, x);
+
+    write_field(buf, labels[i], delim);
+    for (j = 0; j < FORMAT_STATS; ++j)
+    {
+      outbuf_write(buf, &delim, 1);
+      if (isfinite(x[j]))
+        outbuf_exact(buf, x[j]);
+    }
+    outbuf_write(buf, "\n", 1);
+  }
+}
+
+static void write_json(outbuf_t * buf,
+                       char ** labels,
+                       const colstats_t * stats,
+                       long col_count,
+                       long records,
+                       int ess)
+{
+  long i,j;
+  double x[FORMAT_STATS];
+
+  outbuf_string(buf, "{\n  \"samples\": ");
+  outbuf_long(buf, records);
+  outbuf_string(buf, ",\n  \"columns\": [");
+
+  for (i = 0; i < col_count; ++i)
+  {
+    stats_values(stats+i, records, ess, x);
+
+    outbuf_string(buf, i ? ",\n    {\"label\": " : "\n    {\"label\": ");
+    write_json_string(buf, labels[i]);
+    for (j = 0; j < FORMAT_STATS; ++j)
+    {
+      outbuf_string(buf, ", \"");
+      outbuf_string(buf, stat_names[j]);
+      outbuf_string(buf, "\": ");
+      if (isfinite(x[j]))
+        outbuf_exact(buf, x[j]);
+      else
+        outbuf_string(buf, "null");
+    }
+    outbuf_write(buf, "}", 1);
+  }
+
+  outbuf_string(buf, "\n  ]\n}\n");
+}
+
+static void write_bin(outbuf_t * buf,
+                      char ** labels,
+                      const colstats_t * stats,
+                      long col_count,
+                      long records,
+                      int ess)
+{
+  long i;
+  format_header_t hdr;
+  double x[FORMAT_STATS];
+  static const char pad[8];
+
+  memset(&hdr, 0, sizeof(format_header_t));
+  memcpy(hdr.magic, FORMAT_MAGIC, 8);
+  hdr.version = FORMAT_VERSION;
+  hdr.endian = FORMAT_ENDIAN;
+  hdr.col_count = col_count;
+  hdr.sample_count = records;
+  hdr.stat_count = FORMAT_STATS;
+  hdr.labels_offset = sizeof(format_header_t);
+  for (i = 0; i < col_count; ++i)
+    hdr.labels_size += strlen(labels[i]) + 1;
+  hdr.stats_offset = hdr.labels_offset + hdr.labels_size;
+  hdr.stats_offset = (hdr.stats_offset + 7) & ~UINT64_C(7);
+
+  outbuf_write(buf, (const char *)&hdr, sizeof(format_header_t));
+  for (i = 0; i < col_count; ++i)
+    outbuf_write(buf, labels[i], strlen(labels[i]) + 1);
+  outbuf_write(buf, pad, hdr.stats_offset - hdr.labels_offset -
+                         hdr.labels_size);
+
+  for (i = 0; i < col_count; ++i)
+  {
+    stats_values(stats+i, records, ess, x);
+    outbuf_write(buf, (const char *)x, sizeof(x));
+  }
+}
+
+/* write the statistics of col_count columns with the given labels (without
+   the label of generations) in the format selected with --format, to
+   filename, or to standard output if filename is NULL. ESS and efficiency
+   are written only if ess is set */
+void format_write(const char * filename,
+                  char ** labels,
+                  const colstats_t * stats,
+                  long col_count,
+                  long records,
+                  int ess)
+{
+  outbuf_t buf;
+  FILE * fp = filename ? xopen(filename, "wb") : stdout;
+
+  outbuf_init(&buf, fp, filename ? filename : "standard output", OUTBUF_SIZE);
+
+  if (opt_format == FORMAT_CSV)
+    write_delimited(&buf, labels, stats, col_count, records, ess, ',');
+  else if (opt_format == FORMAT_TSV)
+    write_delimited(&buf, labels, stats, col_count, records, ess, '\t');
+  else if (opt_format == FORMAT_JSON)
+    write_json(&buf, labels, stats, col_count, records, ess);
+  else
+    write_bin(&buf, labels, stats, col_count, records, ess);
+
+  outbuf_free(&buf);
+
+  if (filename && fclose(fp))
+    fatal("Unable to write to file %s", filename);
+}
+
+/* read whole file into a zero-terminated buffer */
+static char * read_file(const char * filename, size_t * size)
+{
+  FILE * fp = xopen(filename, "rb");
+  size_t maxsize = 65536;
+  char * data = (char *)xmalloc(maxsize);
+
+  *size = 0;
+  while (1)
+  {
+    *size += fread(data + *size, 1, maxsize - *size - 1, fp);
+    if (*size < maxsize - 1)
+      break;
+    maxsize *= 2;
+    data = (char *)xrealloc(data, maxsize);
+  }
+
+  if (ferror(fp))
+    fatal("Unable to read file %s", filename);
+  fclose(fp);
+
+  data[*size] = 0;
+  return data;
+}
+
+/* detect the format of a summary file from its first bytes. Returns
+   FORMAT_TEXT for anything that is not a machine-readable summary */
+long format_detect(const char * filename)
+{
+  char s[16];
+  FILE * fp = xopen(filename, "rb");
+  size_t size = fread(s, 1, sizeof(s)-1, fp);
+  fclose(fp);
+
+  s[size] = 0;
+
+  if (size >= 8 && !memcmp(s, FORMAT_MAGIC, 8))
+    return FORMAT_BIN;
+  if (s[strspn(s, " \t\r\n")] == '{')
+    return FORMAT_JSON;
+  if (!strncmp(s, "label,", 6))
+    return FORMAT_CSV;
+  if (!strncmp(s, "label\t", 6))
+    return FORMAT_TSV;
+
+  return FORMAT_TEXT;
+}
+
+static long load_bin(const char * filename,
+                     const char * data,
+                     size_t size,
+                     char *** labels,
+                     colstats_t ** stats)
+{
+  long i;
+  const format_header_t * hdr = (const format_header_t *)data;
+
+  if (size < sizeof(format_header_t))
+    fatal("File %s is truncated or corrupt", filename);
+  if (hdr->endian != FORMAT_ENDIAN)
+    fatal("File %s was written on a machine with different endianness",
+          filename);
+  if (hdr->version != FORMAT_VERSION)
+    fatal("File %s has unsupported version %u (expected %d)",
+          filename, hdr->version, FORMAT_VERSION);
+
+  /* offsets and counts are taken from the file, hence they are bounded by
+     dividing the available space instead of multiplying, which could wrap
+     around. Each label takes at least one byte */
+  if (hdr->stat_count != FORMAT_STATS ||
+      hdr->stats_offset > size ||
+      hdr->labels_offset > hdr->stats_offset ||
+      hdr->labels_size > hdr->stats_offset - hdr->labels_offset ||
+      hdr->col_count > hdr->labels_size ||
+      hdr->col_count > (size - hdr->stats_offset) /
+                       (FORMAT_STATS*sizeof(double)))
+    fatal("File %s is truncated or corrupt", filename);
+
+  long col_count = (long)hdr->col_count;
+  const char * p = data + hdr->labels_offset;
+  const char * end = p + hdr->labels_size;
+
+  *labels = (char **)xmalloc((size_t)col_count * sizeof(char *));
+  *stats = (colstats_t *)xmalloc((size_t)col_count * sizeof(colstats_t));
+
+  for (i = 0; i < col_count; ++i)
+  {
+    size_t len = strnlen(p, (size_t)(end - p));
+    if (p + len == end)
+      fatal("File %s is truncated or corrupt", filename);
+    (*labels)[i] = xstrndup(p, len);
+    p += len + 1;
+
+    double x[FORMAT_STATS];
+    memcpy(x, data + hdr->stats_offset + i*sizeof(x), sizeof(x));
+    stats_from_values(x, *stats + i);
+  }
+
+  return col_count;
+}
+
+/* index of statistic name of length len in stat_names, or -1 */
+static long stat_index(const char * name, size_t len)
+{
+  long j;
+
+  for (j = 0; j < FORMAT_STATS; ++j)
+    if (strlen(stat_names[j]) == len && !strncmp(stat_names[j], name, len))
+      return j;
+
+  return -1;
+}
+
+/* read a possibly quoted CSV/TSV field starting at p, store it in field and
+   return a pointer past its end */
+static char * read_field(char * p, char delim, char ** field)
+{
+  if (*p != '"')
+  {
+    char * end = p + strcspn(p, delim == ',' ? ",\r\n" : "\t\r\n");
+    *field = xstrndup(p, (size_t)(end - p));
+    return end;
+  }
+
+  char * q = *field = (char *)xmalloc(strlen(p) + 1);
+  for (++p; *p; ++p)
+  {
+    if (*p == '"')
+    {
+      if (p[1] != '"') { ++p; break; }
+      ++p;
+    }
+    *q++ = *p;
+  }
+  *q = 0;
+
+  return p;
+}
+
+static long load_delimited(const char * filename,
+                           char * data,
+                           char delim,
+                           char *** labels,
+                           colstats_t ** stats)
+{
+  long i,j;
+  long fields = 0;
+  long col_count = 0;
+  long maxcount = 64;
+  long map[FORMAT_STATS+1];
+  char * p = data;
+
+  /* map fields of the header line to statistics, skipping the label */
+  while (*p && *p != '\n' && *p != '\r')
+  {
+    size_t len = strcspn(p, delim == ',' ? ",\r\n" : "\t\r\n");
+
+    if (fields > FORMAT_STATS)
+      fatal("File %s has too many fields in header line", filename);
+    map[fields] = fields ? stat_index(p, len) : -1;
+    fields++;
+
+    p += len;
+    if (*p == delim) ++p;
+  }
+
+  *labels = (char **)xmalloc((size_t)maxcount * sizeof(char *));
+  *stats = (colstats_t *)xmalloc((size_t)maxcount * sizeof(colstats_t));
+
+  while (*p)
+  {
+    double x[FORMAT_STATS];
+    char * field;
+
+    p += strspn(p, "\r\n");
+    if (!*p) break;
+
+    if (col_count == maxcount)
+    {
+      maxcount *= 2;
+      *labels = (char **)xrealloc(*labels, (size_t)maxcount * sizeof(char *));
+      *stats = (colstats_t *)xrealloc(*stats,
+                                      (size_t)maxcount * sizeof(colstats_t));
+    }
+
+    for (j = 0; j < FORMAT_STATS; ++j)
+      x[j] = NAN;
+
+    p = read_field(p, delim, &(*labels)[col_count]);
+    for (i = 1; i < fields; ++i)
+    {
+      if (*p != delim)
+        fatal("Missing fields in record %ld of %s", col_count+1, filename);
+      p = read_field(p+1, delim, &field);
+
+      if (map[i] >= 0 && *field)
+      {
+        char * end;
+        x[map[i]] = strtod(field, &end);
+        if (*end)
+          fatal("Invalid value %s in record %ld of %s",
+                field, col_count+1, filename);
+      }
+      free(field);
+    }
+
+    if (*p && *p != '\r' && *p != '\n')
+      fatal("Too many fields in record %ld of %s", col_count+1, filename);
+
+    stats_from_values(x, *stats + col_count);
+    col_count++;
+  }
+
+  return col_count;
+}
+
+/* minimal JSON reader for the layout written by write_json */
+
+static char * json_ws(char * p)
+{
+  return p + strspn(p, " \t\r\n");
+}
+
+static void json_expect(const char * filename, char ** p, char c)
+{
+  *p = json_ws(*p);
+  if (**p != c)
+    fatal("Invalid JSON in %s: expected '%c'", filename, c);
+  (*p)++;
+}
+
+static char * json_string(const char * filename, char ** p)
+{
+  *p = json_ws(*p);
+  if (**p != '"')
+    fatal("Invalid JSON in %s: expected string", filename);
+
+  char * s = ++(*p);
+  char * q = s;
+
+  for (; **p && **p != '"'; ++(*p))
+  {
+    if (**p == '\\')
+    {
+      ++(*p);
+      switch (**p)
+      {
+        case 'n': *q++ = '\n'; break;
+        case 't': *q++ = '\t'; break;
+        case 'r': *q++ = '\r'; break;
+        case 'b': *q++ = '\b'; break;
+        case 'f': *q++ = '\f'; break;
+        case 'u':
+        {
+          /* only escapes of single-byte characters are written */
+          char hex[5];
+          if (strnlen(*p+1, 4) < 4)
+            fatal("Invalid JSON in %s: unterminated string", filename);
+          memcpy(hex, *p+1, 4);
+          hex[4] = 0;
+          *q++ = (char)strtol(hex, NULL, 16);
+          *p += 4;
+          break;
+        }
+        case 0:
+          fatal("Invalid JSON in %s: unterminated string", filename);
+        default: *q++ = **p;
+      }
+    }
+    else
+      *q++ = **p;
+  }
+
+  if (**p != '"')
+    fatal("Invalid JSON in %s: unterminated string", filename);
+  ++(*p);
+
+  return xstrndup(s, (size_t)(q - s));
+}
+
+/* read a number or null, which is returned as NaN */
+static double json_number(const char * filename, char ** p)
+{
+  char * end;
+
+  *p = json_ws(*p);
+  if (!strncmp(*p, "null", 4))
+  {
+    *p += 4;
+    return NAN;
+  }
+
+  double x = strtod(*p, &end);
+  if (end == *p)
+    fatal("Invalid JSON in %s: expected number", filename);
+  *p = end;
+
+  return x;
+}
+
+static long load_json(const char * filename,
+                      char * data,
+                      char *** labels,
+                      colstats_t ** stats)
+{
+  long j;
+  long col_count = 0;
+  long maxcount = 64;
+  char * p = data;
+
+  *labels = (char **)xmalloc((size_t)maxcount * sizeof(char *));
+  *stats = (colstats_t *)xmalloc((size_t)maxcount * sizeof(colstats_t));
+
+  json_expect(filename, &p, '{');
+  while (1)
+  {
+    char * key = json_string(filename, &p);
+    json_expect(filename, &p, ':');
+
+    if (strcmp(key, "columns"))
+      json_number(filename, &p);
+    else
+    {
+      json_expect(filename, &p, '[');
+      p = json_ws(p);
+      while (*p != ']')
+      {
+        double x[FORMAT_STATS];
+        char * label = NULL;
+
+        if (col_count == maxcount)
+        {
+          maxcount *= 2;
+          *labels = (char **)xrealloc(*labels,
+                                      (size_t)maxcount * sizeof(char *));
+          *stats = (colstats_t *)xrealloc(*stats, (size_t)maxcount *
+                                                  sizeof(colstats_t));
+        }
+
+        for (j = 0; j < FORMAT_STATS; ++j)
+          x[j] = NAN;
+
+        json_expect(filename, &p, '{');
+        while (1)
+        {
+          char * name = json_string(filename, &p);
+          json_expect(filename, &p, ':');
+
+          if (!strcmp(name, "label"))
+          {
+            free(label);
+            label = json_string(filename, &p);
+          }
+          else
+          {
+            double v = json_number(filename, &p);
+            long k = stat_index(name, strlen(name));
+            if (k >= 0)
+              x[k] = v;
+          }
+          free(name);
+
+          p = json_ws(p);
+          if (*p != ',') break;
+          ++p;
+        }
+        json_expect(filename, &p, '}');
+
+        if (!label)
+          fatal("Record %ld of %s has no label", col_count+1, filename);
+
+        (*labels)[col_count] = label;
+        stats_from_values(x, *stats + col_count);
+        col_count++;
+
+        p = json_ws(p);
+        if (*p != ',') break;
+        p = json_ws(p+1);
+      }
+      json_expect(filename, &p, ']');
+    }
+    free(key);
+
+    p = json_ws(p);
+    if (*p != ',') break;
+    ++p;
+  }
+  json_expect(filename, &p, '}');
+
+  return col_count;
+}
+
+/* load a summary written by format_write. Returns the number of records,
+   and stores their labels and statistics. The tint of a record is derived
+   from its efficiency, and is 0 if that is not available */
+long format_load(const char * filename, char *** labels, colstats_t ** stats)
+{
+  size_t size;
+  long col_count;
+  long format = format_detect(filename);
+
+  if (format == FORMAT_TEXT)
+    fatal("File %s is not a CSV, TSV, JSON or binary summary", filename);
+
+  char * data = read_file(filename, &size);
+
+  if (format == FORMAT_BIN)
+    col_count = load_bin(filename, data, size, labels, stats);
+  else if (format == FORMAT_JSON)
+    col_count = load_json(filename, data, labels, stats);
+  else
+    col_count = load_delimited(filename, data,
+                               format == FORMAT_CSV ? ',' : '\t',
+                               labels, stats);
+
+  free(data);
+
+  return col_count;
+}
@@ -0,0 +1,110 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Hash table mapping strings to arbitrary values, with open addressing and
+   linear probing. Keys are copied on insertion, so the table does not depend
+   on the lifetime of the inserted strings. The table is sized at creation to
+   at most half full and does not grow */
+
+static unsigned long hash_fnv(const char * s)
+{
+  unsigned long h = 14695981039346656037UL;
+
+  while (*s)
+  {
+    h ^= (unsigned char)*s++;
+    h *= 1099511628211UL;
+  }
+
+  return h;
+}
+
+hashtable_t * hashtable_create(unsigned long items_count)
+{
+  hashtable_t * ht = (hashtable_t *)xmalloc(sizeof(hashtable_t));
+
+  ht->table_size = 16;
+  while (ht->table_size < 2*items_count)
+    ht->table_size <<= 1;
+
+  ht->entries_count = 0;
+  ht->capacity = items_count;
+  ht->entries = (hashentry_t *)xcalloc(ht->table_size, sizeof(hashentry_t));
+
+  return ht;
+}
+
+void hashtable_destroy(hashtable_t * ht, void (*cb_destroy)(void *))
+{
+  unsigned long i;
+
+  for (i = 0; i < ht->table_size; ++i)
+  {
+    if (ht->entries[i].key)
+    {
+      free(ht->entries[i].key);
+      if (cb_destroy)
+        cb_destroy(ht->entries[i].value);
+    }
+  }
+
+  free(ht->entries);
+  free(ht);
+}
+
+static hashentry_t * hashtable_slot(const hashtable_t * ht, const char * key)
+{
+  unsigned long mask = ht->table_size - 1;
+  unsigned long i = hash_fnv(key) & mask;
+
+  /* the table is never full, hence the loop ends at an empty slot at most */
+  while (ht->entries[i].key && strcmp(ht->entries[i].key,key))
+    i = (i+1) & mask;
+
+  return ht->entries + i;
+}
+
+/* insert a copy of key with the associated value. Returns 0 without
+   modifying the table if key is already present, 1 otherwise */
+int hashtable_insert(hashtable_t * ht, const char * key, void * value)
+{
+  hashentry_t * entry = hashtable_slot(ht,key);
+
+  if (entry->key)
+    return 0;
+
+  if (ht->entries_count == ht->capacity)
+    fatal("Internal error: hash table capacity exceeded");
+
+  entry->key = xstrdup(key);
+  entry->value = value;
+  ht->entries_count++;
+
+  return 1;
+}
+
+/* return the value associated with key, or NULL if key is not present */
+void * hashtable_find(const hashtable_t * ht, const char * key)
+{
+  return hashtable_slot(ht,key)->value;
+}
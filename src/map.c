@@ -42,37 +42,137 @@ static void setbranchlengths(stree_t * tree)
   }
 }
 
-void cmd_map()
+static char * cb_serialize_annotated(const snode_t * node)
+{
+  char * s;
+  const char * label = node->data ? (const char *)node->data : node->label;
+
+  if (xasprintf(&s, "%s:%f", label ? label : "", node->length) == -1)
+    fatal("Memory allocation during newick export failed");
+
+  return s;
+}
+
+static snode_t * find_node(const hashtable_t * index, const char * label)
+{
+  snode_t * node = (snode_t *)hashtable_find(index, label);
+  if (!node)
+    fatal("Could not find label %s\n", label);
+
+  if (node->mark)
+    fatal("Duplicate record for node %s", label);
+
+  return node;
+}
+
+static void annotate_node(snode_t * node,
+                          double median,
+                          double mean,
+                          double etlo,
+                          double ethi,
+                          double hpdlo,
+                          double hpdhi)
+{
+  /* the CI annotation replaces the node label in the output tree */
+  char * annotation;
+  if (opt_map_hpdci)
+    xasprintf(&annotation, "[&95%%={%f, %f}]", hpdlo,hpdhi);
+  else
+    xasprintf(&annotation, "[&95%%={%f, %f}]", etlo,ethi);
+  node->data = annotation;
+  node->mark = 1;
+
+  if (opt_map_median)
+    node->age = median;
+  else
+    node->age = mean;
+}
+
+#define MAP_TABLE   0
+#define MAP_SAMPLES 1
+
+/* next line that is neither blank nor a comment, with leading white-space
+   skipped */
+static char * next_data_line(reader_t * rd)
 {
-  long i;
-  long count;
   char * line;
-  char * label;
-  FILE * fp_out;
 
-  if (!opt_treefile)
-    fatal("Missing tree file (option --tree)");
+  while ((line=reader_getline(rd)))
+  {
+    line += strspn(line, " \t\r\n");
+    if (*line && *line != '#')
+      return line;
+  }
 
-  stree_t * t = stree_parse_newick(opt_treefile);
+  return NULL;
+}
+
+static int has_node_column(const char * line)
+{
+  const char * p = line;
 
-  FILE * fp_table = xopen(opt_mapfile, "r");
+  while ((p = strstr(p, "t_n")))
+  {
+    if (p == line || strchr(" \t", p[-1]))
+      return 1;
+    p += 3;
+  }
+
+  return 0;
+}
 
+/* detect whether rd is a table summary or an MCMC sample file, and leave
+   rd positioned at the first row to be read. Table summaries have a header
+   line starting with "Posterior", either on the first line or after the
+   per-statistic block of --summarize output, and older tables may have a
+   different header followed by rows "t_nX median mean (...) (...)". Sample
+   files have a header with t_n columns followed by numeric rows */
+static int map_detect(reader_t * rd)
+{
+  double x;
+  char * line = next_data_line(rd);
 
-  /* skip header line from table */
-  line = getnextline(fp_table);
+  if (!line)
+    fatal("File %s is empty", opt_mapfile);
 
-  for (i = 0; i < t->tip_count + t->inner_count; ++i)
+  if (!strncmp(line, "Posterior", 9))
+    return MAP_TABLE;
+
+  int node_columns = has_node_column(line);
+
+  reader_pos_t row;
+  reader_tell(rd, &row);
+
+  line = next_data_line(rd);
+  if (line)
   {
-    t->nodes[i]->mark = 0;
-    t->nodes[i]->age = 0;
+    if (node_columns && get_double(line, &x, NULL))
+      return MAP_SAMPLES;
+
+    if (!strncmp(line, "t_n", 3) && strchr(line, '('))
+    {
+      /* re-read the row */
+      reader_seek(rd, &row);
+      return MAP_TABLE;
+    }
+
+    while ((line=next_data_line(rd)))
+      if (!strncmp(line, "Posterior", 9))
+        return MAP_TABLE;
   }
 
-  if (opt_output)
-    fp_out = xopen(opt_output, "w");
-  else
-    fp_out = stdout;
+  fatal("File %s is neither a table summary nor an MCMC sample file",
+        opt_mapfile);
+}
 
-  while ((line=getnextline(fp_table)))
+/* read node ages and CIs from the rows of a table summary */
+static void map_table(reader_t * rd, const hashtable_t * index)
+{
+  long count;
+  char * line;
+  char * label;
+
+  while ((line=reader_getline(rd)))
   {
     char * p = line;
 
@@ -107,20 +207,7 @@ void cmd_map()
       break;
     }
 
-    for (i = t->tip_count; i < t->tip_count + t->inner_count; ++i)
-    {
-      if (!strcmp(t->nodes[i]->label,label+3))
-      {
-        break;
-      }
-    }
-    if (i == t->tip_count + t->inner_count)
-      fatal("Could not find label %s\n", label+3);
-
-    snode_t * node = t->nodes[i];
-
-    if (node->mark)
-      fatal("Duplicate record for node %s", t->nodes[i]->label);
+    snode_t * node = find_node(index, label+3);
 
     double median;
     double mean;
@@ -171,34 +258,134 @@ void cmd_map()
            hpdhi);
     #endif
     
-    if (node->label)
-      free(node->label);
-    
-    if (opt_map_hpdci)
-      xasprintf(&(node->label), "[&95%%={%f, %f}]", hpdlo,hpdhi);
-    else
-      xasprintf(&(node->label), "[&95%%={%f, %f}]", etlo,ethi);
-    node->mark = 1;
-
-    if (opt_map_median)
-      node->age = median;
-    else
-      node->age = mean;
+    annotate_node(node,median,mean,etlo,ethi,hpdlo,hpdhi);
 
     free(label);
   }
 
+}
+
+/* annotate the nodes of the t_n columns among count summarized columns */
+static void map_stats(const hashtable_t * index,
+                      char ** labels,
+                      const colstats_t * stats,
+                      long count)
+{
+  long i;
+
+  for (i = 0; i < count; ++i)
+  {
+    const char * label = labels[i];
+    const colstats_t * st = stats + i;
+
+    if ((strlen(label) <= 3) || strncmp(label,"t_n",3))
+      continue;
+
+    snode_t * node = find_node(index, label+3);
+
+    annotate_node(node,
+                  st->median,
+                  st->mean,
+                  st->q025,
+                  st->q975,
+                  st->hpd025,
+                  st->hpd975);
+  }
+}
+
+/* compute node ages and CIs from the t_n columns of an MCMC sample file,
+   without going through a table summary */
+static void map_samples(const hashtable_t * index)
+{
+  /* load only node age columns unless told otherwise */
+  samples_t * samples = samples_load(opt_mapfile,
+                                     NULL,
+                                     opt_columns ? opt_columns : "t_n*",
+                                     1);
+
+  colstats_t * stats = stats_compute(samples->matrix,
+                                     0,
+                                     samples->sample_count,
+                                     samples->col_count,
+                                     0);
+
+  map_stats(index, samples->labels+1, stats, samples->col_count);
+
+  free(stats);
+  samples_destroy(samples);
+}
+
+/* read node ages and CIs from a summary written with --format */
+static void map_summary(const hashtable_t * index)
+{
+  long i;
+  char ** labels;
+  colstats_t * stats;
+
+  long count = format_load(opt_mapfile, &labels, &stats);
+
+  map_stats(index, labels, stats, count);
+
+  for (i = 0; i < count; ++i)
+    free(labels[i]);
+  free(labels);
+  free(stats);
+}
+
+void cmd_map()
+{
+  long i;
+  FILE * fp_out;
+
+  if (!opt_treefile)
+    fatal("Missing tree file (option --tree)");
+
+  stree_t * t = stree_parse_newick(opt_treefile);
+
+  /* index inner nodes by label for matching table rows */
+  hashtable_t * index = stree_label_index(t,1);
+
+  for (i = 0; i < t->tip_count + t->inner_count; ++i)
+  {
+    t->nodes[i]->mark = 0;
+    t->nodes[i]->age = 0;
+  }
+
+  if (opt_output)
+    fp_out = xopen(opt_output, "w");
+  else
+    fp_out = stdout;
+
+  if (format_detect(opt_mapfile) != FORMAT_TEXT)
+    map_summary(index);
+  else
+  {
+    reader_t * rd = reader_open(opt_mapfile);
+
+    if (map_detect(rd) == MAP_TABLE)
+    {
+      map_table(rd, index);
+      reader_close(rd);
+    }
+    else
+    {
+      reader_close(rd);
+      map_samples(index);
+    }
+  }
+
   /* set branch lengths according to ages */
   setbranchlengths(t);
 
-  char * newick = stree_export_newick(t->root, NULL);
+  report_start(PHASE_OUTPUT);
+  char * newick = stree_export_newick(t->root, cb_serialize_annotated);
   fprintf(fp_out,"%s\n", newick);
   free(newick);
+  report_stop(PHASE_OUTPUT);
 
-  stree_destroy(t,NULL);
+  hashtable_destroy(index,NULL);
+  stree_destroy(t,free);
 
-  fclose(fp_table);
   if (opt_output)
     fclose(fp_out);
 }
-
@@ -0,0 +1,302 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Newick parser for trees stored in files. The file is mapped into memory
+   and parsed iteratively with an explicit stack of open inner nodes, so
+   trees of any depth can be read. Nodes and labels are allocated from an
+   arena owned by the resulting tree. The accepted syntax is the same as that
+   of the grammar in parse_stree.y: a rooted binary tree where tips must be
+   labeled, labels may be quoted, and branch lengths are optional */
+
+#define NEWICK_ARENA_BLOCK (1 << 20)
+
+typedef struct newick_s
+{
+  const char * pos;
+  const char * end;
+
+  /* current line and start of current line, for error reporting */
+  long lineno;
+  const char * linestart;
+
+  arena_t * arena;
+} newick_t;
+
+static void newick_error(const newick_t * nw, const char * s)
+{
+  fatal("%s. (line %ld column %ld)",
+        s, nw->lineno, (long)(nw->pos - nw->linestart) + 1);
+}
+
+/* skip white-space and return next character, or 0 at end of input */
+static int newick_peek(newick_t * nw)
+{
+  while (nw->pos < nw->end)
+  {
+    char c = *nw->pos;
+
+    if (c == '\n')
+    {
+      nw->lineno++;
+      nw->linestart = nw->pos+1;
+    }
+    else if (c != ' ' && c != '\t' && c != '\r')
+      return c;
+
+    nw->pos++;
+  }
+
+  return 0;
+}
+
+static int is_delimiter(char c)
+{
+  return (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '(' ||
+          c == ')' || c == '[' || c == ']' || c == ',' || c == ':' ||
+          c == ';');
+}
+
+/* check whether s matches [+-]?(([0-9]+\.?[0-9]*)|([0-9]*\.?[0-9]+))
+   ([eE][+-]?[0-9]+)? */
+static int is_number(const char * s, const char * end)
+{
+  long digits = 0;
+
+  if (s < end && (*s == '+' || *s == '-')) ++s;
+
+  for (; s < end && *s >= '0' && *s <= '9'; ++s) ++digits;
+  if (s < end && *s == '.') ++s;
+  for (; s < end && *s >= '0' && *s <= '9'; ++s) ++digits;
+
+  if (!digits) return 0;
+
+  if (s < end && (*s == 'e' || *s == 'E'))
+  {
+    ++s;
+    if (s < end && (*s == '+' || *s == '-')) ++s;
+    if (s == end || *s < '0' || *s > '9') return 0;
+    while (s < end && *s >= '0' && *s <= '9') ++s;
+  }
+
+  return s == end;
+}
+
+/* read an unquoted token, i.e. the longest sequence of characters up to the
+   next delimiter. Quotes and brackets are not allowed as first character */
+static const char * newick_token(newick_t * nw, size_t * len)
+{
+  const char * start = nw->pos;
+  char c = *start;
+
+  if (c == '\'' || c == '"' || c == '[' || c == ']')
+    return NULL;
+
+  while (nw->pos < nw->end && !is_delimiter(*nw->pos))
+    nw->pos++;
+
+  *len = (size_t)(nw->pos - start);
+  return start;
+}
+
+/* read a label, quoted or not. Quoted labels are copied without the
+   enclosing quotes, and a backslash escapes a following backslash or
+   closing quote, which are kept verbatim */
+static char * newick_label(newick_t * nw)
+{
+  size_t len;
+  char quote = *nw->pos;
+
+  if (quote == '\'' || quote == '"')
+  {
+    const char * start = ++nw->pos;
+
+    while (nw->pos < nw->end && *nw->pos != quote)
+    {
+      if (*nw->pos == '\n')
+      {
+        nw->lineno++;
+        nw->linestart = nw->pos+1;
+      }
+      else if (*nw->pos == '\\' && nw->pos+1 < nw->end &&
+               (nw->pos[1] == '\\' || nw->pos[1] == quote))
+        nw->pos++;
+      nw->pos++;
+    }
+
+    if (nw->pos == nw->end)
+      newick_error(nw, "Unterminated quoted label");
+
+    len = (size_t)(nw->pos - start);
+    nw->pos++;
+
+    return arena_strndup(nw->arena, start, len);
+  }
+
+  const char * token = newick_token(nw, &len);
+  if (!token)
+    newick_error(nw, "Syntax error, expected label");
+
+  return arena_strndup(nw->arena, token, len);
+}
+
+/* parse an optional branch length preceded by a colon */
+static double newick_length(newick_t * nw)
+{
+  size_t len;
+  char buffer[64];
+
+  if (newick_peek(nw) != ':')
+    return 0;
+
+  nw->pos++;
+  newick_peek(nw);
+
+  const char * token = newick_token(nw, &len);
+  if (!token || !len || !is_number(token, token+len))
+    newick_error(nw, "Syntax error, expected branch length");
+
+  /* copy to zero-terminated buffer for atof, as in parse_stree.y */
+  if (len >= sizeof(buffer))
+    newick_error(nw, "Branch length too long");
+  memcpy(buffer, token, len);
+  buffer[len] = 0;
+
+  return atof(buffer);
+}
+
+static snode_t * newick_parse(newick_t * nw, unsigned int * tip_count)
+{
+  long top = -1;
+  long maxdepth = 64;
+  snode_t * node;
+
+  snode_t ** stack = (snode_t **)xmalloc((size_t)maxdepth*sizeof(snode_t *));
+
+  if (newick_peek(nw) != '(')
+    newick_error(nw, "Syntax error, expected '('");
+
+  *tip_count = 0;
+
+  while (1)
+  {
+    /* start of a subtree: either an inner node or a tip */
+    int c = newick_peek(nw);
+
+    if (!c)
+      newick_error(nw, "Unexpected end of file");
+
+    node = (snode_t *)arena_alloc(nw->arena, sizeof(snode_t));
+
+    if (c == '(')
+    {
+      nw->pos++;
+      if (++top == maxdepth)
+      {
+        maxdepth *= 2;
+        stack = (snode_t **)xrealloc(stack,
+                                     (size_t)maxdepth * sizeof(snode_t *));
+      }
+      stack[top] = node;
+      continue;
+    }
+
+    if (c == ')' || c == ',' || c == ':' || c == ';')
+      newick_error(nw, "Syntax error, expected '(' or label");
+
+    node->label = newick_label(nw);
+    node->length = newick_length(nw);
+    node->leaves = 1;
+    (*tip_count)++;
+
+    /* attach completed subtrees to their parents, closing inner nodes whose
+       second child is complete */
+    while (1)
+    {
+      snode_t * parent = stack[top];
+
+      node->parent = parent;
+
+      if (!parent->left)
+      {
+        parent->left = node;
+        if (newick_peek(nw) != ',')
+          newick_error(nw, "Syntax error, expected ','");
+        nw->pos++;
+        break;
+      }
+
+      parent->right = node;
+      parent->leaves = parent->left->leaves + parent->right->leaves;
+
+      if (newick_peek(nw) != ')')
+        newick_error(nw, "Syntax error, expected ')'");
+      nw->pos++;
+
+      c = newick_peek(nw);
+      if (c && c != ':' && c != ';' && c != ',' && c != ')')
+        parent->label = newick_label(nw);
+      parent->length = newick_length(nw);
+
+      node = parent;
+      if (--top < 0) break;
+    }
+
+    if (top < 0) break;
+  }
+
+  free(stack);
+
+  node->parent = NULL;
+
+  if (newick_peek(nw) != ';')
+    newick_error(nw, "Syntax error, expected ';'");
+  nw->pos++;
+
+  if (newick_peek(nw))
+    newick_error(nw, "Syntax error, unexpected data after ';'");
+
+  return node;
+}
+
+stree_t * stree_parse_newick(const char * filename)
+{
+  newick_t nw;
+  unsigned int tip_count;
+
+  reader_t * rd = reader_open(filename);
+
+  nw.pos = rd->data;
+  nw.end = rd->data + rd->size;
+  nw.lineno = 1;
+  nw.linestart = rd->data;
+  nw.arena = arena_create(NEWICK_ARENA_BLOCK);
+
+  snode_t * root = newick_parse(&nw, &tip_count);
+
+  reader_close(rd);
+
+  stree_t * tree = stree_wraptree(root, tip_count);
+  tree->arena = nw.arena;
+
+  return tree;
+}
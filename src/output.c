@@ -0,0 +1,242 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Buffered output for summaries and combined files. Text is accumulated in
+   a large buffer and written with a single fwrite when the buffer fills up,
+   and numbers are formatted by hand instead of through printf */
+
+void outbuf_init(outbuf_t * buf, FILE * fp, const char * filename, size_t size)
+{
+  buf->fp = fp;
+  buf->filename = filename;
+  buf->data = (char *)xmalloc(size);
+  buf->size = 0;
+  buf->maxsize = size;
+}
+
+void outbuf_flush(outbuf_t * buf)
+{
+  if (buf->size && fwrite(buf->data, 1, buf->size, buf->fp) != buf->size)
+    fatal("Unable to write to file %s", buf->filename);
+  buf->size = 0;
+}
+
+/* flush and release the buffer. The file itself is not closed */
+void outbuf_free(outbuf_t * buf)
+{
+  outbuf_flush(buf);
+  free(buf->data);
+  buf->data = NULL;
+}
+
+void outbuf_write(outbuf_t * buf, const char * s, size_t len)
+{
+  if (buf->size + len > buf->maxsize)
+  {
+    outbuf_flush(buf);
+
+    /* data longer than the buffer is written directly */
+    if (len > buf->maxsize)
+    {
+      if (fwrite(s, 1, len, buf->fp) != len)
+        fatal("Unable to write to file %s", buf->filename);
+      return;
+    }
+  }
+
+  memcpy(buf->data + buf->size, s, len);
+  buf->size += len;
+}
+
+void outbuf_string(outbuf_t * buf, const char * s)
+{
+  outbuf_write(buf, s, strlen(s));
+}
+
+void outbuf_printf(outbuf_t * buf, const char * format, ...)
+{
+  va_list ap;
+  char * s;
+  int len;
+
+  va_start(ap,format);
+  len = xvasprintf(&s, format, ap);
+  va_end(ap);
+
+  if (len < 0)
+    fatal("Unable to allocate enough memory.");
+
+  outbuf_write(buf, s, (size_t)len);
+  free(s);
+}
+
+/* write the decimal digits of u right-aligned ending at end, and return a
+   pointer to the first digit. At least mindigits digits are written */
+static char * format_digits(char * end, unsigned long u, int mindigits)
+{
+  char * p = end;
+
+  do
+  {
+    *--p = '0' + u % 10;
+    u /= 10;
+  }
+  while (u || end - p < mindigits);
+
+  return p;
+}
+
+void outbuf_long(outbuf_t * buf, long x)
+{
+  char s[24];
+  char * end = s + sizeof(s);
+  unsigned long u = x < 0 ? -(unsigned long)x : (unsigned long)x;
+  char * p = format_digits(end, u, 1);
+
+  if (x < 0)
+    *--p = '-';
+
+  outbuf_write(buf, p, (size_t)(end - p));
+}
+
+/* Format x as printf("%f") does, i.e. rounded to six decimal places with
+   ties broken to even on the exact binary value. The fraction of x is
+   m*2^-s with a 53-bit integer m, hence the exact scaled fraction
+   m*10^6*2^-s is computed with 128-bit integers. Values whose integer part
+   does not fit in 64 bits, infinities and NaNs are left to snprintf */
+static int format_fixed(char * s, size_t size, double x)
+{
+#ifndef __SIZEOF_INT128__
+  return snprintf(s, size, "%f", x);
+#else
+  double ax = fabs(x);
+
+  if (!(ax < 9.2e18))
+    return snprintf(s, size, "%f", x);
+
+  double ip = floor(ax);
+  double frac = ax - ip;
+  unsigned long whole = (unsigned long)ip;
+  unsigned long decimals = 0;
+
+  if (frac > 0)
+  {
+    int e;
+    double fr = frexp(frac, &e);
+    int shift = 53 - e;
+
+    /* below 2^-74 the fraction rounds to zero */
+    if (shift < 75)
+    {
+      unsigned __int128 m = (unsigned __int128)(uint64_t)ldexp(fr, 53);
+      unsigned __int128 p = m * 1000000;
+      unsigned __int128 q = p >> shift;
+      unsigned __int128 r = p - (q << shift);
+      unsigned __int128 half = (unsigned __int128)1 << (shift - 1);
+
+      if (r > half || (r == half && (q & 1)))
+        q++;
+
+      decimals = (unsigned long)q;
+      if (decimals == 1000000)
+      {
+        decimals = 0;
+        whole++;
+      }
+    }
+  }
+
+  char tmp[48];
+  char * end = tmp + sizeof(tmp);
+  char * p = format_digits(end, decimals, 6);
+
+  *--p = '.';
+  p = format_digits(p, whole, 1);
+  if (signbit(x))
+    *--p = '-';
+
+  size_t len = (size_t)(end - p);
+  assert(len < size);
+  memcpy(s, p, len);
+  s[len] = 0;
+
+  return (int)len;
+#endif
+}
+
+/* Format x with the fewest significant digits that read back as exactly x.
+   A precision that round-trips remains so for all higher precisions, so
+   the shortest one is found by binary search */
+static int format_shortest(char * s, size_t size, double x)
+{
+  int lo = 1;
+  int hi = 17;
+
+  if (!isfinite(x))
+    return snprintf(s, size, "%g", x);
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    snprintf(s, size, "%.*g", mid, x);
+    if (strtod(s, NULL) == x)
+      hi = mid;
+    else
+      lo = mid+1;
+  }
+
+  return snprintf(s, size, "%.*g", lo, x);
+}
+
+/* write x in the format of the summaries: as %f, or in the shortest form
+   that reads back exactly if --shortest was given */
+void outbuf_double(outbuf_t * buf, double x)
+{
+  char s[512];
+  int len;
+
+  if (opt_shortest)
+    len = format_shortest(s, sizeof(s), x);
+  else
+    len = format_fixed(s, sizeof(s), x);
+
+  outbuf_write(buf, s, (size_t)len);
+}
+
+/* write x in the shortest form that reads back exactly, regardless of
+   --shortest. Used for machine-readable summaries */
+void outbuf_exact(outbuf_t * buf, double x)
+{
+  char s[512];
+  int len = format_shortest(s, sizeof(s), x);
+
+  outbuf_write(buf, s, (size_t)len);
+}
+
+/* write x as a column of the row-per-statistic block of summaries */
+void outbuf_column(outbuf_t * buf, double x)
+{
+  outbuf_write(buf, "  ", 2);
+  outbuf_double(buf, x);
+}
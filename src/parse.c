@@ -21,10 +21,7 @@
 
 #include "summarizer.h"
 
-static char buffer[LINEALLOC];
-static char * line = NULL;
-static size_t line_size = 0;
-static size_t line_maxsize = 0;
+#define TOKENALLOC 64
 
 long get_long(const char * line, long * value)
 {
@@ -143,92 +140,421 @@ long get_string(const char * line, char ** value)
   return ws + end - start;
 }
 
-void reallocline(size_t newmaxsize)
+long count_columns(const char * line)
 {
-  char * temp = (char *)xmalloc((size_t)newmaxsize*sizeof(char));
+  long columns = 0;
+  char * s = xstrdup(line);
+  char * p = s;
+  char * tmp;
+  size_t count = 0;
+  size_t ws;
+
 
-  if (line)
+  while (1)
   {
-    memcpy(temp,line,line_size*sizeof(char));
-    free(line);
+    count = get_string(p, &tmp);
+    if (!count) break;
+
+    p += count;
+
+    columns++;
+    free(tmp);
+
+    ws = strspn(p, " \t\r\n");
+    if (!ws) break;
+
+    p += ws;
   }
-  line = temp;
-  line_maxsize = newmaxsize;
+
+  free(s);
+  return columns;
 }
 
-char * getnextline(FILE * fp)
+/* read the whole file when it cannot be mapped, e.g. a pipe */
+static void reader_fill(reader_t * rd)
 {
-  size_t len = 0;
+  size_t maxsize = rd->size ? rd->size+1 : 65536;
+  ssize_t bytes;
 
-  line_size = 0;
+  rd->data = (char *)xmalloc(maxsize);
+  rd->size = 0;
 
-  /* read from file until newline or eof */
-  while (fgets(buffer, LINEALLOC, fp))
+  while ((bytes = read(rd->fd, rd->data + rd->size, maxsize - rd->size)) != 0)
   {
-    len = strlen(buffer);
+    if (bytes < 0)
+    {
+      if (errno == EINTR) continue;
+      fatal("Cannot read file %s", rd->filename);
+    }
+
+    rd->size += (size_t)bytes;
+    if (rd->size == maxsize)
+    {
+      maxsize *= 2;
+      rd->data = (char *)xrealloc(rd->data, maxsize);
+    }
+  }
+}
 
-    if (line_size + len > line_maxsize)
-      reallocline(line_maxsize + LINEALLOC);
+/* open filename for reading lines. Each reader holds its own state, hence
+   any number of files can be read concurrently by different threads.
+   Regular files are memory-mapped, anything else is read into memory */
+reader_t * reader_open(const char * filename)
+{
+  struct stat st;
 
-    memcpy(line+line_size,buffer,len*sizeof(char));
-    line_size += len;
+  reader_t * rd = (reader_t *)xcalloc(1,sizeof(reader_t));
 
-    if (buffer[len-1] == '\n')
-    {
-      #if 0
-      if (line_size+1 > line_maxsize)
-        reallocline(line_maxsize+1);
+  rd->fd = open(filename, O_RDONLY);
+  if (rd->fd == -1)
+    fatal("Cannot open file %s", filename);
 
-      line[line_size] = 0;
-      #else
-        line[line_size-1] = 0;
-      #endif
+  if (fstat(rd->fd, &st) == -1)
+    fatal("Cannot stat file %s", filename);
 
-      return line;
+  rd->filename = xstrdup(filename);
+  rd->size = (size_t)st.st_size;
+
+  /* mmap cannot map empty files */
+  if (S_ISREG(st.st_mode) && rd->size)
+  {
+    rd->data = (char *)mmap(NULL, rd->size, PROT_READ, MAP_PRIVATE, rd->fd, 0);
+    if (rd->data != MAP_FAILED)
+    {
+      rd->mapped = 1;
+      madvise(rd->data, rd->size, MADV_SEQUENTIAL);
     }
   }
 
-  if (!line_size)
+  if (!rd->mapped && (!S_ISREG(st.st_mode) || rd->size))
+    reader_fill(rd);
+
+  rd->pos = rd->data;
+  rd->end = rd->data + rd->size;
+
+  return rd;
+}
+
+void reader_close(reader_t * rd)
+{
+  if (rd->mapped)
+    munmap(rd->data, rd->size);
+  else if (rd->data)
+    free(rd->data);
+  close(rd->fd);
+  if (rd->line)
+    free(rd->line);
+  free(rd->filename);
+  free(rd);
+}
+
+/* returns a pointer to the beginning of the next line in the mapped file and
+   stores its length (excluding the newline character) in len. The line is not
+   zero-terminated */
+const char * reader_nextline(reader_t * rd, size_t * len)
+{
+  const char * line = rd->pos;
+
+  if (rd->pos == rd->end)
+    return NULL;
+
+  const char * eol = (const char *)memchr(rd->pos, '\n', rd->end - rd->pos);
+
+  if (eol)
+  {
+    *len = eol - line;
+    rd->pos = eol+1;
+  }
+  else
   {
-    free(line);
-    line_maxsize = 0;
-    line = NULL;
+    *len = rd->end - line;
+    rd->pos = rd->end;
+  }
+
+  rd->lineno++;
+  return line;
+}
+
+/* returns the next line as a zero-terminated string excluding the newline
+   character. The string is stored in a buffer owned by the reader and is
+   overwritten by the next call */
+char * reader_getline(reader_t * rd)
+{
+  size_t len;
+  const char * line = reader_nextline(rd,&len);
+
+  if (!line)
     return NULL;
+
+  if (len+1 > rd->line_maxsize)
+  {
+    if (rd->line)
+      free(rd->line);
+    rd->line_maxsize = (len / LINEALLOC + 1) * LINEALLOC;
+    rd->line = (char *)xmalloc(rd->line_maxsize);
   }
 
-  if (line_size == line_maxsize)
-    reallocline(line_maxsize+1);
+  memcpy(rd->line, line, len);
+  rd->line[len] = 0;
 
-  line[line_size] = 0;
-  return line;
+  return rd->line;
 }
 
-long count_columns(const char * line)
+/* store the current position, such that reading can be resumed from it
+   with reader_seek */
+void reader_tell(const reader_t * rd, reader_pos_t * pos)
 {
-  long columns = 0;
-  char * s = xstrdup(line);
-  char * p = s;
-  char * tmp;
-  size_t count = 0;
-  size_t ws;
+  pos->offset = (size_t)(rd->pos - rd->data);
+  pos->lineno = rd->lineno;
+}
 
+void reader_seek(reader_t * rd, const reader_pos_t * pos)
+{
+  assert(pos->offset <= rd->size);
 
-  while (1)
+  rd->pos = rd->data + pos->offset;
+  rd->lineno = pos->lineno;
+}
+
+static int is_space(int c)
+{
+  return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static int is_delim(int c)
+{
+  return (is_space(c) || c == '*' || c == '#');
+}
+
+/* locate the next token in the range [s,end). Returns the number of
+   white-space characters preceding it and stores its length in toklen.
+   toklen is set to 0 for blank lines and comments */
+static size_t token_locate(const char * s, const char * end, size_t * toklen)
+{
+  const char * p = s;
+
+  /* skip all white-space */
+  while (p < end && is_space(*p)) ++p;
+
+  *toklen = 0;
+
+  /* is it a blank line or comment ? */
+  if (p == end || *p == '*' || *p == '#')
+    return p - s;
+
+  const char * start = p;
+
+  /* skip all characters except star, hash and whitespace */
+  while (p < end && !is_delim(*p)) ++p;
+
+  *toklen = p - start;
+  return start - s;
+}
+
+/* exact powers of ten representable as doubles */
+static const double pow10_exact[] =
+{
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* convert the token of length len starting at s using strtod. Used only for
+   the rare numbers that cannot be converted exactly by parse_decimal. The
+   program never calls setlocale() and therefore runs in the C locale */
+static int fallback_strtod(const char * s, size_t len, double * value)
+{
+  char stackbuf[TOKENALLOC];
+  char * buf = stackbuf;
+  char * endptr;
+  int ok;
+
+  /* tokens are not zero-terminated in the mapped file */
+  if (len >= TOKENALLOC)
+    buf = (char *)xmalloc(len+1);
+  memcpy(buf, s, len);
+  buf[len] = 0;
+
+  *value = strtod(buf, &endptr);
+  ok = (endptr == buf+len);
+
+  if (buf != stackbuf)
+    free(buf);
+
+  return ok;
+}
+
+/* parse a decimal floating point number occupying exactly len characters at
+   s, and count the number of characters following the decimal point in the
+   same pass. Numbers with at most 19 significant digits, a mantissa below
+   2^53 and a decimal exponent within [-22,22] are converted exactly with a
+   single multiplication or division (Clinger's fast path). All other numbers
+   are handed over to strtod, such that the result is always identical to
+   strtod. Returns 0 if the token is not a number */
+static int parse_decimal(const char * s,
+                         size_t len,
+                         double * value,
+                         int * decplaces)
+{
+  const char * p = s;
+  const char * end = s+len;
+  const char * dot = NULL;
+  uint64_t mantissa = 0;
+  long digits = 0;
+  long exponent = 0;
+  int negative = 0;
+  int exact = 1;
+
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = (*p++ == '-');
+
+  const char * first = p;
+
+  for (; p < end; ++p)
   {
-    count = get_string(p, &tmp);
-    if (!count) break;
+    if (*p >= '0' && *p <= '9')
+    {
+      /* skip leading zeros */
+      if (!mantissa && *p == '0')
+      {
+        if (dot) exponent--;
+        continue;
+      }
+
+      if (digits < 19)
+      {
+        mantissa = mantissa*10 + (uint64_t)(*p - '0');
+        if (dot) exponent--;
+      }
+      else
+      {
+        /* digits beyond the 19th are truncated */
+        if (*p != '0') exact = 0;
+        if (!dot) exponent++;
+      }
+      digits++;
+    }
+    else if (*p == '.' && !dot)
+      dot = p;
+    else
+      break;
+  }
 
-    p += count;
+  /* at least one digit is required */
+  if (p == first || (dot && p == first+1))
+    return fallback_strtod(s,len,value);
 
-    columns++;
-    free(tmp);
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    long e = 0;
+    int eneg = 0;
 
-    ws = strspn(p, " \t\r\n");
-    if (!ws) break;
+    ++p;
+    if (p < end && (*p == '-' || *p == '+'))
+      eneg = (*p++ == '-');
 
-    p += ws;
+    if (p == end)
+      return 0;
+
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+      if (e < 100000)
+        e = e*10 + (*p - '0');
+
+    exponent += eneg ? -e : e;
   }
 
-  free(s);
-  return columns;
+  /* hexadecimal, infinity, nan and other forms accepted by strtod */
+  if (p != end)
+  {
+    if (!fallback_strtod(s,len,value))
+      return 0;
+  }
+  else if (!mantissa)
+  {
+    *value = negative ? -0.0 : 0.0;
+  }
+  else if (exact && mantissa <= (UINT64_C(1) << 53) &&
+           exponent >= -22 && exponent <= 22)
+  {
+    double x = (double)mantissa;
+
+    if (exponent < 0)
+      x /= pow10_exact[-exponent];
+    else
+      x *= pow10_exact[exponent];
+
+    *value = negative ? -x : x;
+  }
+  else if (!fallback_strtod(s,len,value))
+    return 0;
+
+  if (decplaces && dot)
+    *decplaces = (int)(len - (dot - s) - 1);
+
+  return 1;
+}
+
+long token_long(const char * s, const char * end, long * value)
+{
+  size_t toklen;
+  size_t ws = token_locate(s,end,&toklen);
+  const char * p = s+ws;
+  const char * tokend = p+toklen;
+  unsigned long x = 0;
+  unsigned long limit = LONG_MAX;
+  int negative = 0;
+
+  if (!toklen) return 0;
+
+  if (*p == '-' || *p == '+')
+  {
+    negative = (*p++ == '-');
+    if (negative) limit++;
+  }
+
+  if (p == tokend) return 0;
+
+  for (; p < tokend; ++p)
+  {
+    if (*p < '0' || *p > '9')
+      return 0;
+
+    unsigned long digit = (unsigned long)(*p - '0');
+    if (x > (limit - digit) / 10)
+      return 0;
+
+    x = x*10 + digit;
+  }
+
+  *value = negative ? (long)(0 - x) : (long)x;
+
+  return (long)(ws + toklen);
+}
+
+long token_skip(const char * s, const char * end)
+{
+  size_t toklen;
+  size_t ws = token_locate(s,end,&toklen);
+
+  if (!toklen) return 0;
+
+  return (long)(ws + toklen);
+}
+
+long token_double(const char * s,
+                  const char * end,
+                  double * value,
+                  int * decplaces)
+{
+  size_t toklen;
+  size_t ws = token_locate(s,end,&toklen);
+
+  if (decplaces)
+    *decplaces = 0;
+
+  if (!toklen) return 0;
+
+  if (!parse_decimal(s+ws, toklen, value, decplaces))
+    return 0;
+
+  return (long)(ws + toklen);
 }
@@ -23,7 +23,6 @@
 #include "summarizer.h"
 
 extern int stree_lex();
-extern FILE * stree_in;
 extern void stree_lex_destroy();
 extern int stree_lineno;
 extern int stree_colstart;
@@ -45,18 +44,38 @@ static void dealloc_data(snode_t * node,
   }
 }
 
+/* descend to the leftmost tip of the subtree rooted at node */
+static snode_t * leftmost_tip(snode_t * node)
+{
+  while (node->left)
+    node = node->left;
+
+  return node;
+}
+
+/* free the subtree rooted at root in postorder. The traversal follows the
+   parent pointers instead of recursing, hence it works for any tree depth */
 static void stree_graph_destroy(snode_t * root,
                                 void (*cb_destroy)(void *))
 {
   if (!root) return;
 
-  stree_graph_destroy(root->left, cb_destroy);
-  stree_graph_destroy(root->right, cb_destroy);
+  snode_t * node = leftmost_tip(root);
 
-  dealloc_data(root, cb_destroy);
+  while (1)
+  {
+    snode_t * parent = node->parent;
+    int is_left = (node != root && node == parent->left);
+    int done = (node == root);
 
-  free(root->label);
-  free(root);
+    dealloc_data(node, cb_destroy);
+    free(node->label);
+    free(node);
+
+    if (done) break;
+
+    node = is_left ? leftmost_tip(parent->right) : parent;
+  }
 }
 
 void stree_destroy(stree_t * tree,
@@ -71,12 +90,18 @@ void stree_destroy(stree_t * tree,
     node = tree->nodes[i];
     dealloc_data(node,cb_destroy);
 
+    /* nodes and labels allocated from an arena are freed all at once */
+    if (tree->arena) continue;
+
     if (node->label)
       free(node->label);
 
     free(node);
   }
 
+  if (tree->arena)
+    arena_destroy(tree->arena);
+
   /* deallocate tree structure */
   free(tree->nodes);
   free(tree);
@@ -164,44 +189,57 @@ number: NUMBER   {$$=$1;};
 
 %%
 
-/* fill array in preorder */
-static void fill_nodes_recursive(snode_t * node,
-                                 snode_t ** array,
-                                 unsigned int * tip_index,
-                                 unsigned int * inner_index)
+/* fill array in preorder, tips first and inner nodes starting at position
+   inner_index. The tree is traversed iteratively using the parent pointers */
+static void fill_nodes(snode_t * root,
+                       snode_t ** array,
+                       unsigned int tip_index,
+                       unsigned int inner_index)
 {
-  if (!node->left)
+  snode_t * node = root;
+
+  while (1)
   {
-    array[*tip_index] = node;
-    *tip_index = *tip_index + 1;
-    return;
-  }
+    if (node->left)
+    {
+      array[inner_index++] = node;
+      node = node->left;
+      continue;
+    }
+
+    array[tip_index++] = node;
 
-  array[*inner_index] = node;
-  *inner_index = *inner_index + 1;
+    /* climb up to the first ancestor whose right subtree is unvisited */
+    while (node != root && node == node->parent->right)
+      node = node->parent;
 
-  fill_nodes_recursive(node->left,  array, tip_index, inner_index);
-  fill_nodes_recursive(node->right, array, tip_index, inner_index);
+    if (node == root) break;
 
+    node = node->parent->right;
+  }
 }
 
 static unsigned int stree_count_tips(snode_t * root)
 {
   unsigned int count = 0;
+  snode_t * node = leftmost_tip(root);
+
+  while (1)
+  {
+    count++;
 
-  if (root->left)
-    count += stree_count_tips(root->left);
-  if (root->right)
-    count += stree_count_tips(root->right);
+    while (node != root && node == node->parent->right)
+      node = node->parent;
 
-  if (!root->left && !root->right)
-    return 1;
+    if (node == root) break;
+
+    node = leftmost_tip(node->parent->right);
+  }
 
   return count;
 }
 
-stree_t * stree_wraptree(snode_t * root,
-                         unsigned int tip_count)
+stree_t * stree_wraptree(snode_t * root, unsigned int tip_count)
 {
   unsigned int i;
 
@@ -222,11 +260,8 @@ stree_t * stree_wraptree(snode_t * root,
 
   tree->nodes = (snode_t **)xmalloc((2*tip_count-1)*sizeof(snode_t *));
   
-  unsigned int tip_index = 0;
-  unsigned int inner_index = tip_count;
-
   /* fill tree->nodes in pre-order */
-  fill_nodes_recursive(root, tree->nodes, &tip_index, &inner_index);
+  fill_nodes(root, tree->nodes, 0, tip_count);
 
   tree->tip_count = tip_count;
   tree->edge_count = 2*tip_count-2;
@@ -239,42 +274,6 @@ stree_t * stree_wraptree(snode_t * root,
   return tree;
 }
 
-stree_t * stree_parse_newick(const char * filename)
-{
-  stree_t * tree;
-
-  struct snode_s * root;
-
-  /* reset tip count */
-  tip_cnt = 0;
-
-  /* open input file */
-  stree_in = fopen(filename, "r");
-  if (!stree_in)
-    fatal("Unable to open file (%s)", filename);
-
-  /* create root node */
-  root = (snode_t *)xcalloc(1, sizeof(snode_t));
-
-  if (stree_parse(root))
-  {
-    stree_graph_destroy(root,NULL);
-    root = NULL;
-    fclose(stree_in);
-    stree_lex_destroy();
-    return NULL;
-  }
-
-  if (stree_in) fclose(stree_in);
-
-  stree_lex_destroy();
-
-  /* wrap tree */
-  tree = stree_wraptree(root,tip_cnt);
-
-  return tree;
-}
-
 stree_t * stree_parse_newick_string(const char * s)
 {
   int rc;
@@ -0,0 +1,208 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Per-phase timing and memory usage for --stats-report. Phases are started
+   and stopped by the main thread around the parallel sections, and may run
+   several times, e.g. once per dataset, in which case their times add up.
+   User and system times are those of the whole process and thus include
+   all threads of the pool. The peak RSS of a phase is the peak resident set
+   size of the process at the end of its last run */
+
+typedef struct phase_s
+{
+  long calls;
+  long wall;
+  double user;
+  double system;
+  unsigned long peak_rss;
+
+  /* values at the start of the current run */
+  long start_wall;
+  double start_user;
+  double start_system;
+} phase_t;
+
+static const char * report_names[] = { "none", "text", "json" };
+
+static const char * phase_names[PHASE_MAX] =
+ {
+   "line counting", "parsing", "mean/stdev", "sorting", "HPD", "output"
+ };
+
+static const char * phase_keys[PHASE_MAX] =
+ {
+   "count", "parse", "moments", "sort", "hpd", "output"
+ };
+
+static phase_t phases[PHASE_MAX];
+static long start_wall;
+static double start_user;
+static double start_system;
+static unsigned long bytes_read;
+static long rows_read;
+static pthread_mutex_t input_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* parse the argument of --stats-report */
+long report_parse(const char * s)
+{
+  long i;
+
+  for (i = 1; i < (long)(sizeof(report_names)/sizeof(char *)); ++i)
+    if (!strcmp(s, report_names[i]))
+      return i;
+
+  fatal("Unknown report format %s (expected text or json)", s);
+}
+
+void report_init()
+{
+  memset(phases, 0, sizeof(phases));
+  bytes_read = 0;
+  rows_read = 0;
+
+  start_wall = getusec();
+  arch_get_user_system_time(&start_user, &start_system);
+}
+
+void report_start(int phase)
+{
+  phase_t * p = phases + phase;
+
+  if (!opt_stats_report) return;
+
+  p->start_wall = getusec();
+  arch_get_user_system_time(&p->start_user, &p->start_system);
+}
+
+void report_stop(int phase)
+{
+  phase_t * p = phases + phase;
+  double user, system;
+
+  if (!opt_stats_report) return;
+
+  arch_get_user_system_time(&user, &system);
+  p->wall += getusec() - p->start_wall;
+  p->user += user - p->start_user;
+  p->system += system - p->start_system;
+  p->peak_rss = arch_get_memused();
+  p->calls++;
+}
+
+/* account for bytes and rows of input. May be called concurrently by the
+   threads loading several files */
+void report_input(unsigned long bytes, long rows)
+{
+  if (!opt_stats_report) return;
+
+  pthread_mutex_lock(&input_mutex);
+  bytes_read += bytes;
+  rows_read += rows;
+  pthread_mutex_unlock(&input_mutex);
+}
+
+static double rate(double amount, long usec)
+{
+  return usec > 0 ? amount * 1e6 / usec : 0;
+}
+
+static void print_text(long wall, double user, double system)
+{
+  long i;
+  long input_wall = phases[PHASE_COUNT].wall + phases[PHASE_PARSE].wall;
+
+  fprintf(stderr, "\nStats report (times in seconds, peak RSS in MB)\n\n");
+  fprintf(stderr, "%-15s %6s %10s %10s %10s %10s\n",
+          "phase", "calls", "wall", "user", "system", "peak RSS");
+  for (i = 0; i < PHASE_MAX; ++i)
+  {
+    if (!phases[i].calls) continue;
+
+    fprintf(stderr, "%-15s %6ld %10.3f %10.3f %10.3f %10.1f\n",
+            phase_names[i],
+            phases[i].calls,
+            phases[i].wall / 1e6,
+            phases[i].user,
+            phases[i].system,
+            phases[i].peak_rss / (1024.0*1024.0));
+  }
+  fprintf(stderr, "%-15s %6s %10.3f %10.3f %10.3f %10.1f\n",
+          "total", "",
+          wall / 1e6,
+          user,
+          system,
+          arch_get_memused() / (1024.0*1024.0));
+
+  if (rows_read)
+    fprintf(stderr, "\nRead %lu bytes, %ld rows (%.1f MB/s, %.0f rows/s)\n",
+            bytes_read,
+            rows_read,
+            rate(bytes_read, input_wall) / (1024.0*1024.0),
+            rate(rows_read, input_wall));
+}
+
+static void print_json(long wall, double user, double system)
+{
+  long i;
+  long input_wall = phases[PHASE_COUNT].wall + phases[PHASE_PARSE].wall;
+
+  fprintf(stderr, "{\"phases\": {");
+  for (i = 0; i < PHASE_MAX; ++i)
+    fprintf(stderr,
+            "%s\"%s\": {\"calls\": %ld, \"wall\": %.6f, \"user\": %.6f, "
+            "\"system\": %.6f, \"peak_rss\": %lu}",
+            i ? ", " : "",
+            phase_keys[i],
+            phases[i].calls,
+            phases[i].wall / 1e6,
+            phases[i].user,
+            phases[i].system,
+            phases[i].peak_rss);
+  fprintf(stderr, "}, \"total\": {\"wall\": %.6f, \"user\": %.6f, "
+          "\"system\": %.6f, \"peak_rss\": %lu}",
+          wall / 1e6, user, system, arch_get_memused());
+  fprintf(stderr, ", \"bytes_read\": %lu, \"rows\": %ld, "
+          "\"bytes_per_sec\": %.1f, \"rows_per_sec\": %.1f}\n",
+          bytes_read,
+          rows_read,
+          rate(bytes_read, input_wall),
+          rate(rows_read, input_wall));
+}
+
+/* print the report on standard error */
+void report_print()
+{
+  double user, system;
+
+  if (!opt_stats_report) return;
+
+  arch_get_user_system_time(&user, &system);
+  long wall = getusec() - start_wall;
+  user -= start_user;
+  system -= start_system;
+
+  if (opt_stats_report == REPORT_JSON)
+    print_json(wall, user, system);
+  else
+    print_text(wall, user, system);
+}
@@ -0,0 +1,1062 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+#define SAMPLES_MINALLOC 1024
+#define SAMPLES_MINCHUNK (1024*1024)
+
+static char ** getlabels(const char * line)
+{
+  long columns = 0;
+  size_t count = 0;
+  size_t ws;
+  char * s = xstrdup(line);
+  char * p = s;
+  char * tmp;
+  char ** labels;
+
+
+  while (1)
+  {
+    count = get_string(p, &tmp);
+    if (!count) break;
+
+    p += count;
+
+    columns++;
+    free(tmp);
+
+    ws = strspn(p, " \t\r\n");
+    if (!ws) break;
+
+    p += ws;
+  }
+
+  labels = (char **)xmalloc((size_t)columns * sizeof(char *));
+  columns = 0;
+  p = s;
+  while (1)
+  {
+    count = get_string(p, &tmp);
+    if (!count) break;
+
+    p += count;
+
+    labels[columns++] = tmp;
+
+    ws = strspn(p, " \t\r\n");
+    if (!ws) break;
+
+    p += ws;
+  }
+
+  free(s);
+
+  return labels;
+}
+
+/* read the index file in a single pass, growing the records array as
+   needed. Returns the total number of records */
+static long read_index(const char * indexfile,
+                       long ** dataset_records_count,
+                       long * dataset_count)
+{
+  long count;
+  long linelong = 0;
+  long line_count = 0;
+  long records = 0;
+  long maxcount = 16;
+  char * line;
+  char * p;
+
+  long * counts = (long *)xmalloc((size_t)maxcount * sizeof(long));
+
+  reader_t * rd = reader_open(indexfile);
+
+  while((line=reader_getline(rd)))
+  {
+    ++line_count;
+    p = line;
+
+    count = get_long(p,&linelong);
+    if (!count)
+      fatal("Invalid entry in line %ld of %s", line_count, indexfile);
+
+    if (linelong <= 0)
+      fatal("Invalid record on line %ld of %s", line_count, indexfile);
+
+    if (line_count > maxcount)
+    {
+      maxcount *= 2;
+      counts = (long *)xrealloc(counts, (size_t)maxcount * sizeof(long));
+    }
+
+    counts[line_count-1] = linelong;
+    records += linelong;
+  }
+
+  reader_close(rd);
+
+  *dataset_records_count = counts;
+  *dataset_count = line_count;
+
+  return records;
+}
+
+static void matrix_resize(double ** matrix, long col_count, long newsize)
+{
+  long i;
+
+  for (i = 0; i < col_count; ++i)
+    matrix[i] = (double *)xrealloc(matrix[i],
+                                   (size_t)newsize * sizeof(double));
+}
+
+/* estimate the number of sample lines in the region [start,end) from the
+   length of its first line */
+static long estimate_lines(const char * start, const char * end)
+{
+  const char * eol = (const char *)memchr(start, '\n', end - start);
+  size_t linelen = eol ? (size_t)(eol - start) + 1 : 0;
+  long lines;
+
+  lines = linelen ? (end - start) / linelen : 0;
+  lines += lines / 16;
+
+  return MAX(lines, SAMPLES_MINALLOC);
+}
+
+/* select the columns whose labels match any of the comma-separated glob
+   patterns in columns. Labels of unselected columns are released and
+   the remaining ones are compacted. Returns a map from each file column to
+   its matrix column, or -1 if the column is not selected */
+static long * select_columns(char ** labels,
+                             long * col_count,
+                             const char * columns,
+                             int verbose)
+{
+  long i,j;
+  long selected = 0;
+  long * colmap = (long *)xmalloc((size_t)(*col_count) * sizeof(long));
+  char * patterns = xstrdup(columns);
+
+  for (i = 0; i < *col_count; ++i)
+  {
+    char * pattern = patterns;
+
+    colmap[i] = -1;
+    while (pattern)
+    {
+      char * next = strchr(pattern, ',');
+      if (next) *next = 0;
+
+      int match = (*pattern && !fnmatch(pattern, labels[i+1], 0));
+
+      if (next) *next = ',';
+      if (match)
+      {
+        colmap[i] = selected++;
+        break;
+      }
+
+      pattern = next ? next+1 : NULL;
+    }
+  }
+  free(patterns);
+
+  if (!selected)
+    fatal("No columns match the patterns given by --columns (%s)",
+          columns);
+
+  /* compact labels, keeping the label of generations */
+  for (i = 0, j = 1; i < *col_count; ++i)
+  {
+    if (colmap[i] == -1)
+      free(labels[i+1]);
+    else
+      labels[j++] = labels[i+1];
+  }
+
+  if (verbose)
+    fprintf(stdout, "Selected %ld out of %ld columns...\n",
+            selected, *col_count);
+
+  *col_count = selected;
+  return colmap;
+}
+
+static long parse_row(const char * p,
+                      const char * end,
+                      double ** matrix,
+                      long col_count,
+                      const long * colmap,
+                      long row)
+{
+  long i;
+  long count;
+  long sample_num;
+  double x;
+
+  /* skip sample number */
+  count = token_long(p,end,&sample_num);
+  if (!count) return 0;
+
+  p += count;
+
+  /* read remaining elements of current row */
+  for (i = 0; i < col_count; ++i)
+  {
+    /* unselected columns are skipped without conversion */
+    if (colmap && colmap[i] == -1)
+    {
+      count = token_skip(p,end);
+      if (!count) return 0;
+
+      p += count;
+      continue;
+    }
+
+    count = token_double(p,end,&x,NULL);
+    if (!count) return 0;
+
+    p += count;
+
+    matrix[colmap ? colmap[i] : i][row] = x;
+  }
+
+  return 1;
+}
+
+/* burn-in and thinning applied per dataset. Lines are numbered from 0
+   starting at the first sample line of the file */
+typedef struct filter_s
+{
+  long dataset_count;
+  long * first;                 /* first line of each dataset */
+  long * records;               /* number of lines in each dataset */
+  long * burnin;                /* lines discarded from each dataset */
+  long thin;
+} filter_t;
+
+static int filter_active(void)
+{
+  return (opt_burnin > 0 || opt_burnin_fraction > 0 || opt_thin > 1);
+}
+
+/* create filter for the given datasets. If records is NULL, a single
+   dataset of unknown size is assumed */
+static filter_t * filter_create(long dataset_count, const long * records)
+{
+  long i;
+  long first = 0;
+
+  filter_t * filter = (filter_t *)xmalloc(sizeof(filter_t));
+
+  filter->dataset_count = records ? dataset_count : 1;
+  filter->first = (long *)xmalloc((size_t)filter->dataset_count*sizeof(long));
+  filter->records = (long *)xmalloc((size_t)filter->dataset_count*sizeof(long));
+  filter->burnin = (long *)xmalloc((size_t)filter->dataset_count*sizeof(long));
+  filter->thin = opt_thin;
+
+  for (i = 0; i < filter->dataset_count; ++i)
+  {
+    filter->first[i] = first;
+    filter->records[i] = records ? records[i] : LONG_MAX;
+
+    if (opt_burnin_fraction > 0)
+    {
+      assert(records);
+      filter->burnin[i] = (long)(opt_burnin_fraction * records[i]);
+    }
+    else
+      filter->burnin[i] = opt_burnin;
+
+    if (records && filter->burnin[i] >= records[i])
+      fatal("Burn-in discards all %ld samples of dataset %ld",
+            records[i], i+1);
+
+    first += filter->records[i];
+  }
+
+  return filter;
+}
+
+static void filter_destroy(filter_t * filter)
+{
+  free(filter->first);
+  free(filter->records);
+  free(filter->burnin);
+  free(filter);
+}
+
+/* number of samples kept from dataset */
+static long filter_kept(const filter_t * filter, long dataset)
+{
+  long n = filter->records[dataset] - filter->burnin[dataset];
+
+  return (n + filter->thin - 1) / filter->thin;
+}
+
+/* decide whether line is kept. Lines must be queried in increasing order;
+   dataset holds the dataset of the previously queried line */
+static int filter_keep(const filter_t * filter, long line, long * dataset)
+{
+  long d = *dataset;
+
+  while (d+1 < filter->dataset_count && line >= filter->first[d+1])
+    ++d;
+  *dataset = d;
+
+  long r = line - filter->first[d] - filter->burnin[d];
+
+  return (r >= 0 && r % filter->thin == 0);
+}
+
+/* parse all sample lines in the chunk into the chunk's own column segments,
+   growing them as necessary, or into the chunk's sketches if it has any.
+   Lines discarded by burn-in or thinning are neither converted nor stored.
+   Parsing stops at the first invalid line or when the number of lines
+   exceeds the chunk limit */
+static void parse_chunk(chunk_t * chunk)
+{
+  long i;
+  const char * line = chunk->start;
+  const char * eol;
+  long dataset = 0;
+  double * row = NULL;
+  double ** rowmatrix = NULL;
+
+  chunk->rows = 0;
+  chunk->lines = 0;
+  chunk->error_line = -1;
+
+  if (chunk->sketches)
+  {
+    /* a single row is parsed at a time and added to the sketches */
+    row = (double *)xmalloc((size_t)chunk->col_count * sizeof(double));
+    rowmatrix = (double **)xmalloc((size_t)chunk->col_count *
+                                   sizeof(double *));
+    for (i = 0; i < chunk->col_count; ++i)
+      rowmatrix[i] = row+i;
+  }
+  else
+  {
+    chunk->matrix = (double **)xcalloc((size_t)chunk->col_count,
+                                       sizeof(double *));
+    matrix_resize(chunk->matrix, chunk->col_count, chunk->maxsamples);
+  }
+
+  while (line < chunk->end)
+  {
+    eol = (const char *)memchr(line, '\n', chunk->end - line);
+    if (!eol) eol = chunk->end;
+
+    if (chunk->progress)
+      progress_update(line - chunk->progress_base);
+
+    if (chunk->lines == chunk->limit)
+    {
+      chunk->overflow = 1;
+      break;
+    }
+
+    if (chunk->filter &&
+        !filter_keep(chunk->filter, chunk->first_line+chunk->lines, &dataset))
+    {
+      chunk->lines++;
+      line = eol+1;
+      continue;
+    }
+
+    if (!rowmatrix && chunk->rows == chunk->maxsamples)
+    {
+      chunk->maxsamples *= 2;
+      matrix_resize(chunk->matrix, chunk->col_count, chunk->maxsamples);
+    }
+
+    if (!parse_row(line,
+                   eol,
+                   rowmatrix ? rowmatrix : chunk->matrix,
+                   chunk->file_col_count,
+                   chunk->colmap,
+                   rowmatrix ? 0 : chunk->rows))
+    {
+      chunk->error_line = chunk->lines;
+      break;
+    }
+
+    if (rowmatrix)
+      for (i = 0; i < chunk->col_count; ++i)
+        sketch_insert(chunk->sketches[i], row[i]);
+
+    chunk->rows++;
+    chunk->lines++;
+    line = eol+1;
+  }
+
+  if (rowmatrix)
+  {
+    free(rowmatrix);
+    free(row);
+  }
+}
+
+static void count_chunk(chunk_t * chunk)
+{
+  const char * p = chunk->start;
+
+  chunk->lines = 0;
+  while (p < chunk->end)
+  {
+    const char * eol = (const char *)memchr(p, '\n', chunk->end - p);
+    chunk->lines++;
+    p = eol ? eol+1 : chunk->end;
+  }
+}
+
+typedef struct chunk_job_s
+{
+  chunk_t * chunks;
+  void (*fn)(chunk_t *);
+
+  /* bytes processed so far, if progress is reported as chunks complete */
+  int progress;
+  unsigned long done;
+  pthread_mutex_t mutex;
+} chunk_job_t;
+
+static void cb_chunk(long index, void * data)
+{
+  chunk_job_t * job = (chunk_job_t *)data;
+  chunk_t * chunk = job->chunks + index;
+
+  job->fn(chunk);
+
+  if (job->progress)
+  {
+    pthread_mutex_lock(&job->mutex);
+    job->done += (unsigned long)(chunk->end - chunk->start);
+    progress_update(job->done);
+    pthread_mutex_unlock(&job->mutex);
+  }
+}
+
+/* process each chunk with fn on the thread pool. A single chunk is processed
+   directly, as when files of a list are loaded by the threads of the pool.
+   If progress is set, progress is reported as chunks complete */
+static void run_chunks(chunk_t * chunks,
+                       long chunk_count,
+                       void (*fn)(chunk_t *),
+                       int progress)
+{
+  chunk_job_t job;
+
+  if (chunk_count == 1)
+  {
+    fn(chunks);
+    return;
+  }
+
+  job.chunks = chunks;
+  job.fn = fn;
+  job.progress = progress;
+  job.done = 0;
+  if (progress)
+    job.done = (unsigned long)(chunks[0].start - chunks[0].progress_base);
+  pthread_mutex_init(&job.mutex, NULL);
+
+  threadpool_run(chunk_count, cb_chunk, &job);
+
+  pthread_mutex_destroy(&job.mutex);
+}
+
+/* split the region [start,end) into at most count chunks at newline
+   boundaries and return the actual number of chunks */
+static long split_chunks(const char * start,
+                         const char * end,
+                         long count,
+                         chunk_t * chunks)
+{
+  long i;
+  long n = 0;
+  size_t size = end - start;
+  const char * p = start;
+
+  for (i = 0; i < count && p < end; ++i)
+  {
+    const char * q = start + size * (i+1) / count;
+
+    if (q < p) q = p;
+    if (i == count-1 || q >= end)
+      q = end;
+    else
+    {
+      const char * eol = (const char *)memchr(q, '\n', end - q);
+      q = eol ? eol+1 : end;
+    }
+
+    chunks[n].start = p;
+    chunks[n].end = q;
+    n++;
+
+    p = q;
+  }
+
+  return n;
+}
+
+/* load the samples of filename, split into at most thread_count chunks that
+   are parsed by the thread pool. Only columns matching the patterns in
+   columns are kept, unless columns is NULL, and burn-in and thinning are
+   applied if filter is set. If verbose is not set, progress is not reported,
+   as when several files are loaded concurrently */
+static samples_t * load_file(const char * filename,
+                             const char * indexfile,
+                             const char * columns,
+                             int apply_filter,
+                             long thread_count,
+                             int verbose)
+{
+  long i,j;
+  long total_records = 0;
+  long chunk_count;
+  size_t len;
+  const char * line;
+  char * header;
+  chunk_t * chunks;
+  filter_t * filter = NULL;
+
+  samples_t * samples = (samples_t *)xcalloc(1,sizeof(samples_t));
+
+  /* the index file is small; read it first so that the matrix can be
+     allocated with the exact number of records */
+  if (indexfile)
+  {
+    printf("Reading records...\n");
+    total_records = read_index(indexfile,
+                               &samples->dataset_records_count,
+                               &samples->dataset_count);
+  }
+
+  reader_t * rd = reader_open(filename);
+
+  /* skip line containing header */
+  line = reader_nextline(rd,&len);
+  if (!line)
+    fatal("File %s is empty", filename);
+  header = xstrndup(line,len);
+
+  /* compute number of columns in the file */
+  samples->col_count = count_columns(header);
+  samples->labels = getlabels(header);
+  free(header);
+
+  /* subtract generations */
+  samples->col_count--;
+
+  for (i = 1; i < opt_skipcount; ++i)
+    reader_nextline(rd,&len);
+
+  if (verbose)
+    fprintf(stdout, "Skipped %ld header line(s)...\n", opt_skipcount);
+
+  long file_col_count = samples->col_count;
+  long * colmap = NULL;
+
+  if (columns)
+    colmap = select_columns(samples->labels, &samples->col_count, columns,
+                            verbose);
+
+  if (verbose)
+    fprintf(stdout, "Processing samples, each %ld columns...\n",
+            samples->col_count);
+
+  long col_count = samples->col_count;
+  long first_line = rd->lineno + 1;
+
+  /* do not bother splitting small files among threads */
+  thread_count = MIN(thread_count,
+                     (long)((rd->end - rd->pos) / SAMPLES_MINCHUNK) + 1);
+
+  chunks = (chunk_t *)xcalloc((size_t)thread_count, sizeof(chunk_t));
+  chunk_count = split_chunks(rd->pos, rd->end, thread_count, chunks);
+
+  /* the file contains only header lines */
+  if (!chunk_count)
+    fatal("File %s contains no samples", filename);
+
+  /* burn-in and thinning need the position of each line within its dataset.
+     Lines are counted beforehand if the input is split into chunks, or if
+     the burn-in is a fraction of an unknown number of samples */
+  if (apply_filter && filter_active())
+  {
+    int counted = 0;
+
+    if (chunk_count > 1 || (opt_burnin_fraction > 0 && !indexfile))
+    {
+      if (verbose)
+        report_start(PHASE_COUNT);
+      run_chunks(chunks, chunk_count, count_chunk, 0);
+      if (verbose)
+        report_stop(PHASE_COUNT);
+      for (i = 1; i < chunk_count; ++i)
+        chunks[i].first_line = chunks[i-1].first_line + chunks[i-1].lines;
+      counted = 1;
+    }
+
+    if (indexfile)
+      filter = filter_create(samples->dataset_count,
+                             samples->dataset_records_count);
+    else if (counted)
+    {
+      long lines = chunks[chunk_count-1].first_line +
+                   chunks[chunk_count-1].lines;
+      filter = filter_create(1, &lines);
+    }
+    else
+      filter = filter_create(1, NULL);
+  }
+
+  for (i = 0; i < chunk_count; ++i)
+  {
+    chunks[i].col_count = col_count;
+    chunks[i].file_col_count = file_col_count;
+    chunks[i].colmap = colmap;
+    chunks[i].filter = filter;
+    chunks[i].limit = indexfile ? total_records : LONG_MAX;
+
+    if (opt_approx)
+    {
+      chunks[i].sketches = (sketch_t **)xmalloc((size_t)col_count *
+                                                sizeof(sketch_t *));
+      for (j = 0; j < col_count; ++j)
+        chunks[i].sketches[j] = sketch_create();
+      continue;
+    }
+
+    /* with an index file and a single chunk we know the exact number of
+       records, otherwise make an estimate from the chunk size and the length
+       of its first sample line, and grow the columns as needed */
+    if (indexfile && chunk_count == 1)
+    {
+      long kept = total_records;
+      if (filter)
+        for (kept = 0, j = 0; j < filter->dataset_count; ++j)
+          kept += filter_kept(filter,j);
+      chunks[i].maxsamples = MAX(kept,1);
+    }
+    else
+    {
+      chunks[i].maxsamples = estimate_lines(chunks[i].start, chunks[i].end);
+      if (filter)
+        chunks[i].maxsamples = chunks[i].maxsamples / filter->thin + 1;
+    }
+  }
+
+  /* a single chunk reports progress while parsing, otherwise progress is
+     reported as chunks complete */
+  if (verbose)
+  {
+    progress_init("Processing data...", rd->size);
+    chunks[0].progress = (chunk_count == 1);
+    chunks[0].progress_base = rd->data;
+    report_start(PHASE_PARSE);
+  }
+  run_chunks(chunks, chunk_count, parse_chunk, verbose);
+  if (verbose)
+  {
+    report_stop(PHASE_PARSE);
+    progress_done();
+  }
+
+  /* check chunks in order such that the first invalid line is reported */
+  long line_count = 0;
+  long sample_count = 0;
+  for (i = 0; i < chunk_count; ++i)
+  {
+    if (chunks[i].error_line >= 0)
+      fatal("Invalid entry in line %ld of %s",
+            first_line + line_count + chunks[i].error_line, filename);
+
+    line_count += chunks[i].lines;
+    sample_count += chunks[i].rows;
+
+    if (chunks[i].overflow || (indexfile && line_count > total_records))
+      fatal("Number of records in %s does not match with index file %s",
+            filename, indexfile);
+  }
+
+  report_input(rd->size, line_count);
+  reader_close(rd);
+
+  if (indexfile && line_count != total_records)
+    fatal("Number of records in %s does not match with index file %s",
+          filename, indexfile);
+
+  if (!sample_count)
+    fatal("File %s contains no samples", filename);
+
+  double ** matrix = NULL;
+  if (opt_approx)
+  {
+    /* merge the sketches of all chunks into those of the first one */
+    samples->sketches = chunks[0].sketches;
+    for (j = 1; j < chunk_count; ++j)
+    {
+      for (i = 0; i < col_count; ++i)
+      {
+        sketch_merge(samples->sketches[i], chunks[j].sketches[i]);
+        sketch_destroy(chunks[j].sketches[i]);
+      }
+      free(chunks[j].sketches);
+    }
+  }
+  else if (chunk_count == 1)
+  {
+    /* release unused space */
+    matrix = chunks[0].matrix;
+    if (sample_count != chunks[0].maxsamples)
+      matrix_resize(matrix, col_count, sample_count);
+  }
+  else
+  {
+    /* stitch column segments in original sample order, one column at a time
+       to keep peak memory low */
+    matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
+    for (i = 0; i < col_count; ++i)
+    {
+      long offset = 0;
+
+      matrix[i] = (double *)xmalloc((size_t)sample_count * sizeof(double));
+      for (j = 0; j < chunk_count; ++j)
+      {
+        memcpy(matrix[i]+offset,
+               chunks[j].matrix[i],
+               (size_t)chunks[j].rows * sizeof(double));
+        offset += chunks[j].rows;
+        free(chunks[j].matrix[i]);
+      }
+    }
+    for (j = 0; j < chunk_count; ++j)
+      free(chunks[j].matrix);
+  }
+  free(chunks);
+  if (colmap)
+    free(colmap);
+
+  if (verbose)
+    fprintf(stdout, "Read %ld lines (samples) each %ld columns...\n",
+            line_count, col_count);
+
+  if (filter)
+  {
+    /* per-dataset summaries are computed on the kept samples */
+    if (indexfile)
+      for (i = 0; i < samples->dataset_count; ++i)
+        samples->dataset_records_count[i] = filter_kept(filter,i);
+
+    if (verbose)
+      fprintf(stdout, "Kept %ld samples after burn-in and thinning...\n",
+              sample_count);
+    filter_destroy(filter);
+  }
+
+  samples->matrix = matrix;
+  samples->sample_count = sample_count;
+
+  return samples;
+}
+
+samples_t * samples_load(const char * filename,
+                         const char * indexfile,
+                         const char * columns,
+                         int filter)
+{
+  return load_file(filename, indexfile, columns, filter, opt_threads, 1);
+}
+
+typedef struct list_job_s
+{
+  char ** filenames;
+  samples_t ** parts;
+  const char * columns;
+  int filter;
+} list_job_t;
+
+static void cb_load_file(long index, void * data)
+{
+  list_job_t * job = (list_job_t *)data;
+
+  job->parts[index] = load_file(job->filenames[index], NULL, job->columns,
+                                job->filter, 1, 0);
+}
+
+/* load the MCMC files listed in listfile, one per line as for --combine.
+   Each file forms a dataset, exactly as if the files were combined and
+   loaded with the resulting index file. Files are loaded concurrently, each
+   by a single thread of the pool */
+samples_t * samples_load_list(const char * listfile,
+                              const char * columns,
+                              int filter)
+{
+  long i,j;
+  long count = 0;
+  long maxcount = 16;
+  char * line;
+  list_job_t job;
+
+  reader_t * rd = reader_open(listfile);
+
+  job.columns = columns;
+  job.filter = filter;
+  job.filenames = (char **)xmalloc((size_t)maxcount * sizeof(char *));
+  while ((line=reader_getline(rd)))
+  {
+    if (count == maxcount)
+    {
+      maxcount *= 2;
+      job.filenames = (char **)xrealloc(job.filenames,
+                                        (size_t)maxcount * sizeof(char *));
+    }
+    job.filenames[count] = xstrdup(line);
+    job.filenames[count][strcspn(job.filenames[count],"\r\n")] = 0;
+    count++;
+  }
+  reader_close(rd);
+
+  if (!count)
+    fatal("File %s does not list any MCMC files", listfile);
+
+  fprintf(stdout, "Processing %ld files...\n", count);
+
+  job.parts = (samples_t **)xmalloc((size_t)count * sizeof(samples_t *));
+  report_start(PHASE_PARSE);
+  threadpool_run(count, cb_load_file, &job);
+  report_stop(PHASE_PARSE);
+
+  samples_t * samples = (samples_t *)xcalloc(1,sizeof(samples_t));
+  samples->col_count = job.parts[0]->col_count;
+  samples->dataset_count = count;
+  samples->dataset_records_count = (long *)xmalloc((size_t)count *
+                                                   sizeof(long));
+
+  for (i = 0; i < count; ++i)
+  {
+    if (job.parts[i]->col_count != samples->col_count)
+      fatal("File %s contains %ld columns instead of %ld",
+            job.filenames[i], job.parts[i]->col_count, samples->col_count);
+
+    samples->dataset_records_count[i] = job.parts[i]->sample_count;
+    samples->sample_count += job.parts[i]->sample_count;
+
+    fprintf(stdout, "Read %ld samples each %ld columns from %s\n",
+            job.parts[i]->sample_count, job.parts[i]->col_count,
+            job.filenames[i]);
+  }
+
+  /* concatenate datasets one column at a time to keep peak memory low */
+  samples->matrix = (double **)xmalloc((size_t)samples->col_count *
+                                       sizeof(double *));
+  for (j = 0; j < samples->col_count; ++j)
+  {
+    long offset = 0;
+
+    samples->matrix[j] = (double *)xmalloc((size_t)samples->sample_count *
+                                           sizeof(double));
+    for (i = 0; i < count; ++i)
+    {
+      memcpy(samples->matrix[j]+offset,
+             job.parts[i]->matrix[j],
+             (size_t)job.parts[i]->sample_count * sizeof(double));
+      offset += job.parts[i]->sample_count;
+
+      free(job.parts[i]->matrix[j]);
+      job.parts[i]->matrix[j] = NULL;
+    }
+  }
+
+  /* labels are taken from the first file */
+  samples->labels = job.parts[0]->labels;
+  job.parts[0]->labels = NULL;
+
+  for (i = 0; i < count; ++i)
+  {
+    if (job.parts[i]->labels)
+    {
+      for (j = 0; j < job.parts[i]->col_count+1; ++j)
+        free(job.parts[i]->labels[j]);
+      free(job.parts[i]->labels);
+    }
+    free(job.parts[i]->matrix);
+    free(job.parts[i]);
+    free(job.filenames[i]);
+  }
+  free(job.parts);
+  free(job.filenames);
+
+  fprintf(stdout, "Read %ld samples in %ld datasets...\n",
+          samples->sample_count, samples->dataset_count);
+
+  return samples;
+}
+
+/* apply burn-in and thinning to samples loaded from a cache file by
+   compacting the columns in place */
+static void filter_samples(samples_t * samples)
+{
+  long i,j,k;
+  long dataset;
+  filter_t * filter;
+
+  if (samples->dataset_count)
+    filter = filter_create(samples->dataset_count,
+                           samples->dataset_records_count);
+  else
+    filter = filter_create(1, &samples->sample_count);
+
+  for (i = 0; i < samples->col_count; ++i)
+  {
+    double * x = samples->matrix[i];
+
+    dataset = 0;
+    for (j = 0, k = 0; j < samples->sample_count; ++j)
+      if (filter_keep(filter, j, &dataset))
+        x[k++] = x[j];
+  }
+
+  samples->sample_count = 0;
+  for (i = 0; i < filter->dataset_count; ++i)
+  {
+    if (samples->dataset_count)
+      samples->dataset_records_count[i] = filter_kept(filter,i);
+    samples->sample_count += filter_kept(filter,i);
+  }
+
+  fprintf(stdout, "Kept %ld samples after burn-in and thinning...\n",
+          samples->sample_count);
+
+  filter_destroy(filter);
+}
+
+/* keep the columns selected by --columns and apply burn-in and thinning to
+   samples loaded in full, by compacting the columns in place */
+static void select_samples(samples_t * samples)
+{
+  long i;
+
+  if (opt_columns)
+  {
+    long file_col_count = samples->col_count;
+    long * colmap = select_columns(samples->labels, &samples->col_count,
+                                   opt_columns, 1);
+
+    /* columns of a cache point into the mapped file */
+    for (i = 0; i < file_col_count; ++i)
+      if (colmap[i] != -1)
+        samples->matrix[colmap[i]] = samples->matrix[i];
+      else if (!samples->cache_data)
+        free(samples->matrix[i]);
+
+    free(colmap);
+  }
+
+  if (filter_active())
+    filter_samples(samples);
+}
+
+/* obtain samples either by parsing the MCMC file or from a cache file, and
+   optionally write them to a cache file before they are modified. A cache
+   holds all columns and samples, such that --columns, --burnin and --thin
+   can be applied when it is loaded */
+samples_t * samples_get(const char * indexfile)
+{
+  samples_t * samples;
+
+  if (opt_cachefile)
+  {
+    report_start(PHASE_PARSE);
+    samples = cache_load(opt_cachefile);
+    report_stop(PHASE_PARSE);
+    report_input(samples->cache_size, samples->sample_count);
+
+    /* an index file overrides the record counts stored in the cache */
+    if (indexfile)
+    {
+      if (samples->dataset_records_count)
+        free(samples->dataset_records_count);
+
+      long total_records = read_index(indexfile,
+                                      &samples->dataset_records_count,
+                                      &samples->dataset_count);
+      if (total_records != samples->sample_count)
+        fatal("Number of records in %s does not match with index file %s",
+              opt_cachefile, indexfile);
+    }
+
+    select_samples(samples);
+  }
+  else if (opt_writecache)
+  {
+    /* parse everything, write the cache, then select */
+    if (opt_list)
+      samples = samples_load_list(opt_summarize, NULL, 0);
+    else
+      samples = samples_load(opt_summarize, indexfile, NULL, 0);
+
+    cache_write(opt_writecache, samples);
+    select_samples(samples);
+  }
+  else if (opt_list)
+    samples = samples_load_list(opt_summarize, opt_columns, 1);
+  else
+    samples = samples_load(opt_summarize, indexfile, opt_columns, 1);
+
+  return samples;
+}
+
+void samples_destroy(samples_t * samples)
+{
+  long i;
+
+  for (i = 0; i < samples->col_count+1; ++i)
+    free(samples->labels[i]);
+  free(samples->labels);
+
+  if (samples->sketches)
+  {
+    for (i = 0; i < samples->col_count; ++i)
+      sketch_destroy(samples->sketches[i]);
+    free(samples->sketches);
+  }
+  else if (samples->cache_data)
+    munmap(samples->cache_data, samples->cache_size);
+  else
+    for (i = 0; i < samples->col_count; ++i)
+      free(samples->matrix[i]);
+  if (samples->matrix)
+    free(samples->matrix);
+
+  if (samples->dataset_records_count)
+    free(samples->dataset_records_count);
+
+  free(samples);
+}
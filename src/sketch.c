@@ -0,0 +1,327 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Mergeable quantile sketch used to summarize a column in memory independent
+   of the number of samples.
+
+   Values are kept in a hierarchy of compactors, as in the sketches of
+   Manku, Rajagopalan and Lindsay (1998) and Karnin, Lang and Liberty (2016):
+   values at level h have weight 2^h. When a level accumulates SKETCH_K
+   values it is sorted, and every other value, starting at a random offset,
+   is promoted to the next level while the others are discarded.
+
+   A compaction of level h changes the estimated rank of any value by at
+   most 2^h. The sum of these amounts over all compactions (err) is therefore
+   a deterministic bound on the rank error of every quantile query. Each
+   level contributes at most n/SKETCH_K, hence the normalized rank error is
+   at most L/SKETCH_K for a sketch with L levels, i.e. about
+   log2(n/SKETCH_K)/SKETCH_K. In practice the random offsets make the errors
+   cancel out and the actual error is far smaller than the bound.
+
+   Mean and variance are computed exactly with Welford's method and merged
+   with the pairwise formula of Chan et al. (1979). Minimum and maximum are
+   exact. */
+
+#define SKETCH_K 4096
+
+typedef struct sketch_item_s
+{
+  double value;
+  double weight;
+} sketch_item_t;
+
+sketch_t * sketch_create(void)
+{
+  sketch_t * s = (sketch_t *)xcalloc(1,sizeof(sketch_t));
+
+  s->min = INFINITY;
+  s->max = -INFINITY;
+  s->seed = UINT64_C(0x9E3779B97F4A7C15);
+
+  return s;
+}
+
+void sketch_destroy(sketch_t * s)
+{
+  long h;
+
+  for (h = 0; h < s->levels; ++h)
+    free(s->level[h]);
+  free(s->level);
+  free(s->size);
+  free(s->maxsize);
+  free(s);
+}
+
+/* xorshift64 generator for the compaction offsets */
+static int sketch_randbit(sketch_t * s)
+{
+  s->seed ^= s->seed << 13;
+  s->seed ^= s->seed >> 7;
+  s->seed ^= s->seed << 17;
+
+  return (int)(s->seed >> 63);
+}
+
+static void sketch_append(sketch_t * s, long h, const double * x, long count)
+{
+  if (h == s->levels)
+  {
+    s->levels++;
+    s->level = (double **)xrealloc(s->level,
+                                   (size_t)s->levels * sizeof(double *));
+    s->size = (long *)xrealloc(s->size, (size_t)s->levels * sizeof(long));
+    s->maxsize = (long *)xrealloc(s->maxsize,
+                                  (size_t)s->levels * sizeof(long));
+
+    s->maxsize[h] = SKETCH_K;
+    s->size[h] = 0;
+    s->level[h] = (double *)xmalloc((size_t)SKETCH_K * sizeof(double));
+  }
+
+  if (s->size[h] + count > s->maxsize[h])
+  {
+    while (s->size[h] + count > s->maxsize[h])
+      s->maxsize[h] *= 2;
+    s->level[h] = (double *)xrealloc(s->level[h],
+                                     (size_t)s->maxsize[h] * sizeof(double));
+  }
+
+  memcpy(s->level[h] + s->size[h], x, (size_t)count * sizeof(double));
+  s->size[h] += count;
+}
+
+/* halve level h into level h+1. If the level has an odd number of values,
+   the largest one stays at level h */
+static void sketch_compact(sketch_t * s, long h)
+{
+  long i;
+  double * x = s->level[h];
+  long n = s->size[h] & ~1L;
+  long offset = sketch_randbit(s);
+
+  sort_double(x, s->size[h]);
+
+  /* promoted values are written over the first half of the level */
+  for (i = 0; i < n/2; ++i)
+    x[i] = x[2*i+offset];
+
+  double last = x[s->size[h]-1];
+
+  sketch_append(s, h+1, x, n/2);
+
+  /* level array may have been reallocated */
+  x = s->level[h];
+  if (s->size[h] & 1)
+  {
+    x[0] = last;
+    s->size[h] = 1;
+  }
+  else
+    s->size[h] = 0;
+
+  s->err += ldexp(1,(int)h);
+}
+
+static void sketch_compress(sketch_t * s)
+{
+  long h;
+
+  for (h = 0; h < s->levels; ++h)
+    if (s->size[h] >= SKETCH_K)
+      sketch_compact(s,h);
+}
+
+void sketch_insert(sketch_t * s, double x)
+{
+  /* Welford update */
+  s->n++;
+  double delta = x - s->mean;
+  s->mean += delta / s->n;
+  s->m2 += delta * (x - s->mean);
+
+  if (x < s->min) s->min = x;
+  if (x > s->max) s->max = x;
+
+  if (!s->levels || s->size[0] == SKETCH_K)
+  {
+    if (s->levels)
+      sketch_compress(s);
+    sketch_append(s, 0, &x, 1);
+  }
+  else
+    s->level[0][s->size[0]++] = x;
+}
+
+/* merge sketch src into dst. The result summarizes the values of both */
+void sketch_merge(sketch_t * dst, const sketch_t * src)
+{
+  long h;
+
+  if (!src->n) return;
+
+  if (dst->n)
+  {
+    long n = dst->n + src->n;
+    double delta = src->mean - dst->mean;
+
+    dst->m2 += src->m2 + delta*delta * ((double)dst->n * src->n / n);
+    dst->mean += delta * src->n / n;
+    dst->n = n;
+  }
+  else
+  {
+    dst->n = src->n;
+    dst->mean = src->mean;
+    dst->m2 = src->m2;
+  }
+
+  dst->min = MIN(dst->min, src->min);
+  dst->max = MAX(dst->max, src->max);
+  dst->err += src->err;
+
+  for (h = 0; h < src->levels; ++h)
+    sketch_append(dst, h, src->level[h], src->size[h]);
+
+  sketch_compress(dst);
+}
+
+/* normalized bound on the rank error of quantiles obtained from sketch */
+double sketch_error(const sketch_t * s)
+{
+  return s->n ? s->err / s->n : 0;
+}
+
+static int cb_item_cmp(const void * a, const void * b)
+{
+  const sketch_item_t * x = (const sketch_item_t *)a;
+  const sketch_item_t * y = (const sketch_item_t *)b;
+
+  if (x->value < y->value) return -1;
+  if (x->value > y->value) return 1;
+  return 0;
+}
+
+/* value at 0-based position r in the sorted order of the samples, estimated
+   from items sorted by value with cumulative weights cum */
+static double item_at_rank(const sketch_item_t * items,
+                           const double * cum,
+                           long count,
+                           double r)
+{
+  long lo = 0;
+  long hi = count-1;
+
+  /* first item whose cumulative weight exceeds r */
+  while (lo < hi)
+  {
+    long mid = lo + (hi-lo)/2;
+    if (cum[mid] > r)
+      hi = mid;
+    else
+      lo = mid+1;
+  }
+
+  return items[lo].value;
+}
+
+/* fill statistics from sketch. Order statistics follow the same positions
+   as the exact computation in stats.c, and are approximate */
+void sketch_stats(const sketch_t * s, colstats_t * st)
+{
+  long h,i,j;
+  long count = 0;
+  long n = s->n;
+
+  for (h = 0; h < s->levels; ++h)
+    count += s->size[h];
+
+  sketch_item_t * items = (sketch_item_t *)xmalloc((size_t)count *
+                                                   sizeof(sketch_item_t));
+  double * cum = (double *)xmalloc((size_t)count * sizeof(double));
+
+  for (h = 0, j = 0; h < s->levels; ++h)
+    for (i = 0; i < s->size[h]; ++i, ++j)
+    {
+      items[j].value = s->level[h][i];
+      items[j].weight = ldexp(1,(int)h);
+    }
+
+  qsort(items, (size_t)count, sizeof(sketch_item_t), cb_item_cmp);
+
+  /* weights are exact integers, and sum up to n */
+  double sum = 0;
+  for (i = 0; i < count; ++i)
+  {
+    sum += items[i].weight;
+    cum[i] = sum;
+  }
+
+  st->mean = s->mean;
+  st->stdev = sqrt(s->m2/(n-1));
+  st->min = s->min;
+  st->max = s->max;
+  st->tint = 0;
+
+  long median_line = n / 2;
+  st->median = item_at_rank(items,cum,count,median_line);
+  if ((n & 1) == 0)
+  {
+    st->median += item_at_rank(items,cum,count,median_line-1);
+    st->median /= 2;
+  }
+
+  st->q025 = item_at_rank(items,cum,count,(long)(n*.025));
+  st->q975 = item_at_rank(items,cum,count,(long)(n*.975));
+
+  /* shortest interval spanning the same number of positions as the exact
+     95% HPD interval. Each item is tried as left end at its first position,
+     and the right end is found by advancing a second pointer */
+  long lrow = (long)(n*0.05/2);
+  long urow = (long)(n*(1-0.05/2));
+  double diffrow = urow - lrow;
+  double w = st->q975 - st->q025;
+
+  st->hpd025 = st->q025;
+  st->hpd975 = st->q975;
+
+  for (i = 0, j = 0; i < count; ++i)
+  {
+    double l = i ? cum[i-1] : 0;
+
+    if (l + diffrow >= n) break;
+
+    while (cum[j] <= l + diffrow)
+      ++j;
+
+    if (items[j].value - items[i].value < w)
+    {
+      w = items[j].value - items[i].value;
+      st->hpd025 = items[i].value;
+      st->hpd975 = items[j].value;
+    }
+  }
+
+  free(cum);
+  free(items);
+}
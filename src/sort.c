@@ -0,0 +1,220 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* LSD radix sort with 11-bit digits (6 passes over 64-bit keys) */
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_SIZE - 1)
+#define RADIX_PASSES 6
+
+/* arrays shorter than this are sorted with insertion sort */
+#define SORT_MINRADIX 64
+
+/* map the IEEE-754 representation of a double to an unsigned integer whose
+   ordering matches the ordering of the double: flip all bits of negative
+   numbers and only the sign bit of positive ones */
+static inline uint64_t double_to_key(double x)
+{
+  uint64_t u;
+
+  memcpy(&u, &x, sizeof(uint64_t));
+  return u ^ (-(u >> 63) | UINT64_C(0x8000000000000000));
+}
+
+static inline double key_to_double(uint64_t u)
+{
+  double x;
+
+  u ^= ((u >> 63) - 1) | UINT64_C(0x8000000000000000);
+  memcpy(&x, &u, sizeof(uint64_t));
+  return x;
+}
+
+static void insertion_sort(double * x, long n)
+{
+  long i,j;
+
+  for (i = 1; i < n; ++i)
+  {
+    double v = x[i];
+    for (j = i; j > 0 && x[j-1] > v; --j)
+      x[j] = x[j-1];
+    x[j] = v;
+  }
+}
+
+/* sort n doubles in ascending order. Keys are stored in place of the
+   values in x and are moved between x and a temporary buffer of the same
+   size. Passes in which all keys share the same digit are skipped */
+void sort_double(double * x, long n)
+{
+  long i;
+  int pass;
+  uint64_t * hist;
+  uint64_t * src;
+  uint64_t * dst;
+
+  if (n < SORT_MINRADIX)
+  {
+    insertion_sort(x,n);
+    return;
+  }
+
+  hist = (uint64_t *)xcalloc(RADIX_PASSES * RADIX_SIZE, sizeof(uint64_t));
+  src = (uint64_t *)x;
+  dst = (uint64_t *)xmalloc((size_t)n * sizeof(uint64_t));
+
+  /* convert to keys and compute all histograms in one pass */
+  for (i = 0; i < n; ++i)
+  {
+    uint64_t key = double_to_key(x[i]);
+
+    memcpy(src+i, &key, sizeof(uint64_t));
+    for (pass = 0; pass < RADIX_PASSES; ++pass)
+      hist[pass*RADIX_SIZE + ((key >> (pass*RADIX_BITS)) & RADIX_MASK)]++;
+  }
+
+  for (pass = 0; pass < RADIX_PASSES; ++pass)
+  {
+    uint64_t * h = hist + pass*RADIX_SIZE;
+    int shift = pass*RADIX_BITS;
+    uint64_t sum = 0;
+    long d;
+
+    /* skip pass if all keys have the same digit */
+    uint64_t first;
+    memcpy(&first, src, sizeof(uint64_t));
+    if (h[(first >> shift) & RADIX_MASK] == (uint64_t)n)
+      continue;
+
+    /* exclusive prefix sums give the output position of each digit */
+    for (d = 0; d < RADIX_SIZE; ++d)
+    {
+      uint64_t c = h[d];
+      h[d] = sum;
+      sum += c;
+    }
+
+    for (i = 0; i < n; ++i)
+    {
+      uint64_t key;
+      memcpy(&key, src+i, sizeof(uint64_t));
+      memcpy(dst + h[(key >> shift) & RADIX_MASK]++, &key, sizeof(uint64_t));
+    }
+
+    SWAP(src,dst);
+  }
+
+  /* convert keys back to doubles, copying them into x if necessary */
+  for (i = 0; i < n; ++i)
+  {
+    uint64_t key;
+    memcpy(&key, src+i, sizeof(uint64_t));
+    x[i] = key_to_double(key);
+  }
+
+  free(src == (uint64_t *)x ? dst : src);
+  free(hist);
+}
+
+/* restore heap order below position i of a min-heap of runs keyed by the
+   key of their current element */
+static void heap_sift(long * heap,
+                      long count,
+                      long i,
+                      const uint64_t * key)
+{
+  long r = heap[i];
+
+  while (2*i+1 < count)
+  {
+    long c = 2*i+1;
+
+    if (c+1 < count && key[heap[c+1]] < key[heap[c]])
+      ++c;
+    if (key[r] <= key[heap[c]])
+      break;
+
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = r;
+}
+
+/* merge run_count consecutive runs of x, each sorted in ascending order and
+   of length runs[i], such that x becomes sorted. Runs are merged in a single
+   pass with a min-heap holding the current element of each run. Values are
+   compared by their keys, giving the same order as sort_double */
+void merge_runs(double * x, const long * runs, long run_count)
+{
+  long i,j;
+  long n = 0;
+  long count = 0;
+
+  if (run_count < 2) return;
+
+  long * pos = (long *)xmalloc((size_t)run_count * sizeof(long));
+  long * end = (long *)xmalloc((size_t)run_count * sizeof(long));
+  long * heap = (long *)xmalloc((size_t)run_count * sizeof(long));
+  uint64_t * key = (uint64_t *)xmalloc((size_t)run_count * sizeof(uint64_t));
+
+  for (i = 0; i < run_count; ++i)
+  {
+    pos[i] = n;
+    n += runs[i];
+    end[i] = n;
+
+    if (runs[i])
+    {
+      key[i] = double_to_key(x[pos[i]]);
+      heap[count++] = i;
+    }
+  }
+
+  for (i = count/2 - 1; i >= 0; --i)
+    heap_sift(heap, count, i, key);
+
+  double * out = (double *)xmalloc((size_t)n * sizeof(double));
+
+  for (j = 0; j < n; ++j)
+  {
+    long r = heap[0];
+
+    out[j] = x[pos[r]++];
+
+    if (pos[r] < end[r])
+      key[r] = double_to_key(x[pos[r]]);
+    else
+      heap[0] = heap[--count];
+
+    heap_sift(heap, count, 0, key);
+  }
+
+  memcpy(x, out, (size_t)n * sizeof(double));
+
+  free(out);
+  free(key);
+  free(heap);
+  free(end);
+  free(pos);
+}
@@ -0,0 +1,420 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* FFT twiddle factors w[k] = exp(-2*pi*i*k/m) for k=0..m/2-1, where m is
+   the length of the real input of realfft() */
+typedef struct fft_table_s
+{
+  long m;
+  double * cos;
+  double * sin;
+} fft_table_t;
+
+typedef struct stats_job_s
+{
+  double ** matrix;
+  long start;
+  long records;
+  colstats_t * stats;
+  fft_table_t * fft;
+
+  /* zero-padded FFT buffer of fft->m doubles for each pool thread */
+  double ** scratch;
+
+  /* lengths of sorted runs to be merged instead of sorted */
+  const long * runs;
+  long run_count;
+} stats_job_t;
+
+static fft_table_t * fft_table_create(long m)
+{
+  long k;
+  fft_table_t * t = (fft_table_t *)xmalloc(sizeof(fft_table_t));
+
+  t->m = m;
+  t->cos = (double *)xmalloc((size_t)(m/2) * sizeof(double));
+  t->sin = (double *)xmalloc((size_t)(m/2) * sizeof(double));
+
+  for (k = 0; k < m/2; ++k)
+  {
+    t->cos[k] = cos(2*M_PI*k/m);
+    t->sin[k] = -sin(2*M_PI*k/m);
+  }
+
+  return t;
+}
+
+static void fft_table_destroy(fft_table_t * t)
+{
+  free(t->cos);
+  free(t->sin);
+  free(t);
+}
+
+/* in-place iterative radix-2 FFT of h = m/2 complex numbers stored as
+   interleaved real and imaginary parts in a */
+static void complexfft(double * a, const fft_table_t * t)
+{
+  long h = t->m/2;
+  long i,j,k,len;
+
+  /* bit-reversal permutation */
+  for (i = 1, j = 0; i < h; ++i)
+  {
+    long bit = h >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      SWAP(a[2*i],a[2*j]);
+      SWAP(a[2*i+1],a[2*j+1]);
+    }
+  }
+
+  /* butterflies; the twiddle for a transform of length len is w[k*m/len] */
+  for (len = 2; len <= h; len <<= 1)
+  {
+    long stride = t->m / len;
+    for (i = 0; i < h; i += len)
+    {
+      for (k = 0; k < len/2; ++k)
+      {
+        double wr = t->cos[k*stride];
+        double wi = t->sin[k*stride];
+        double * u = a + 2*(i+k);
+        double * v = a + 2*(i+k+len/2);
+
+        double vr = v[0]*wr - v[1]*wi;
+        double vi = v[0]*wi + v[1]*wr;
+
+        v[0] = u[0] - vr;
+        v[1] = u[1] - vi;
+        u[0] += vr;
+        u[1] += vi;
+      }
+    }
+  }
+}
+
+/* in-place FFT of m real numbers. On output, a[2k] and a[2k+1] hold the real
+   and imaginary parts of X[k] for 0 < k < m/2, while a[0] and a[1] hold the
+   real parts of X[0] and X[m/2] (both purely real) */
+static void realfft(double * a, const fft_table_t * t)
+{
+  long h = t->m/2;
+  long k;
+
+  /* transform the real input as h complex numbers */
+  complexfft(a,t);
+
+  double r0 = a[0];
+  a[0] = r0 + a[1];
+  a[1] = r0 - a[1];
+
+  /* untangle the spectra of even and odd samples, processing pairs k and
+     h-k together */
+  for (k = 1; k <= h/2; ++k)
+  {
+    double * p = a + 2*k;
+    double * q = a + 2*(h-k);
+
+    double er = (p[0] + q[0]) / 2;
+    double ei = (p[1] - q[1]) / 2;
+    double odr = (p[1] + q[1]) / 2;
+    double odi = (q[0] - p[0]) / 2;
+
+    double wr = t->cos[k];
+    double wi = t->sin[k];
+
+    double tr = odr*wr - odi*wi;
+    double ti = odr*wi + odi*wr;
+
+    p[0] = er + tr;
+    p[1] = ei + ti;
+    q[0] = er - tr;
+    q[1] = ti - ei;
+  }
+}
+
+/* This calculates Efficiency or Tint using Geyer's (1992) initial positive
+   sequence method. Autocorrelations of all lags are obtained in O(n log n)
+   as the inverse Fourier transform of the power spectrum of the zero-padded
+   normalized samples. The buffer a must hold t->m doubles, m >= 2n */
+static double eff_ict(const double * y,
+                      long n,
+                      double mean,
+                      double stdev,
+                      const fft_table_t * t,
+                      double * a)
+{
+  long i;
+  long m = t->m;
+  long h = m/2;
+  double tint = 1;
+  double rho, rho0 = 0;
+
+  if (stdev/(fabs(mean)+1) < 1E-9)
+    return n;
+
+  for (i = 0; i < n; ++i)
+    a[i] = (y[i]-mean)/stdev;
+  memset(a+n, 0, (size_t)(m-n) * sizeof(double));
+
+  realfft(a,t);
+
+  /* power spectrum |X[k]|^2 for k=0..h, written in place of X */
+  double ph = a[1]*a[1];
+  a[0] = a[0]*a[0];
+  for (i = 1; i < h; ++i)
+    a[i] = a[2*i]*a[2*i] + a[2*i+1]*a[2*i+1];
+  a[h] = ph;
+
+  /* the power spectrum of a real sequence is real and even, hence its
+     inverse transform equals its forward transform divided by m */
+  for (i = 1; i < h; ++i)
+    a[m-i] = a[i];
+
+  realfft(a,t);
+
+  /* a[2i] now holds m times the autocovariance at lag i, for 0 < i < h */
+  for (i = 1; i < n-10; ++i)
+  {
+    rho = a[2*i] / m / (n-1);
+
+    if (i > 10 && rho+rho0 < 0)
+      break;
+
+    tint += rho*2;
+    rho0 = rho;
+  }
+
+  return tint;
+}
+
+static void hpd_interval(double * x,
+                         long n,
+                         double * ltail,
+                         double * rtail,
+                         double alpha)
+{
+  long lrow = (long)(n*alpha/2);
+  long urow = (long)(n*(1-alpha/2));
+  long diffrow = urow - lrow;
+  long l,r;
+
+  long left = lrow;
+
+
+  double w = x[urow] - x[lrow];
+
+  *ltail = x[lrow];
+  *rtail = x[urow];
+
+  if (n <= 2) return;
+
+  for (l=0,r=l+diffrow; r < n; l++,r++)
+  {
+    if (x[r] - x[l] < w)
+    {
+      left = l;
+      w = x[r] - x[l];
+    }
+  }
+
+  *ltail = x[left];
+  *rtail = x[left + diffrow];
+}
+
+/* stage 1: mean, standard deviation and tint, computed on the samples in
+   their original order */
+static void cb_moments(long col, void * data)
+{
+  stats_job_t * job = (stats_job_t *)data;
+  double * x = job->matrix[col] + job->start;
+  long n = job->records;
+  colstats_t * st = job->stats + col;
+  long j;
+
+  double sum = 0;
+  for (j = 0; j < n; ++j)
+    sum += x[j];
+  st->mean = sum/n;
+
+  double sd = 0;
+  for (j = 0; j < n; ++j)
+    sd += (x[j]-st->mean) * (x[j]-st->mean);
+  st->stdev = sqrt(sd/(n-1));
+
+  if (job->fft)
+  {
+    double * a = job->scratch[threadpool_worker()];
+    st->tint = eff_ict(x,n,st->mean,st->stdev,job->fft,a);
+  }
+}
+
+/* stage 2: sort column in place */
+static void cb_sort(long col, void * data)
+{
+  stats_job_t * job = (stats_job_t *)data;
+
+  if (job->runs)
+    merge_runs(job->matrix[col] + job->start, job->runs, job->run_count);
+  else
+    sort_double(job->matrix[col] + job->start, job->records);
+}
+
+/* stage 3: order statistics and HPD interval on the sorted column */
+static void cb_quantiles(long col, void * data)
+{
+  stats_job_t * job = (stats_job_t *)data;
+  double * x = job->matrix[col] + job->start;
+  long n = job->records;
+  colstats_t * st = job->stats + col;
+  long median_line = n / 2;
+
+  st->median = x[median_line];
+  if ((n & 1) == 0)
+  {
+    st->median += x[median_line-1];
+    st->median /= 2;
+  }
+
+  st->min = x[0];
+  st->max = x[n-1];
+  st->q025 = x[(long)(n*.025)];
+  st->q975 = x[(long)(n*.975)];
+
+  hpd_interval(x,n,&st->hpd025,&st->hpd975,0.05);
+}
+
+static colstats_t * stats_run(stats_job_t * job, long col_count)
+{
+  job->stats = (colstats_t *)xcalloc((size_t)col_count, sizeof(colstats_t));
+
+  report_start(PHASE_MOMENTS);
+  threadpool_run(col_count, cb_moments, job);
+  report_stop(PHASE_MOMENTS);
+
+  report_start(PHASE_SORT);
+  threadpool_run(col_count, cb_sort, job);
+  report_stop(PHASE_SORT);
+
+  report_start(PHASE_QUANTILES);
+  threadpool_run(col_count, cb_quantiles, job);
+  report_stop(PHASE_QUANTILES);
+
+  return job->stats;
+}
+
+/* compute statistics for records samples starting at sample start in each
+   column. Columns are independent and are distributed dynamically among the
+   threads of the pool. Tint is computed only if ess is set, and always
+   before the columns are sorted in place */
+colstats_t * stats_compute(double ** matrix,
+                           long start,
+                           long records,
+                           long col_count,
+                           int ess)
+{
+  stats_job_t job;
+  colstats_t * stats;
+  long i;
+
+  memset(&job, 0, sizeof(stats_job_t));
+  job.matrix = matrix;
+  job.start = start;
+  job.records = records;
+
+  /* zero-padding to at least twice the number of samples avoids circular
+     wrap-around of the autocorrelations */
+  if (ess)
+  {
+    long m = 4;
+    while (m < 2*records)
+      m <<= 1;
+    job.fft = fft_table_create(m);
+
+    /* one buffer per thread, reused across the columns it processes */
+    job.scratch = (double **)xmalloc((size_t)threadpool_size() *
+                                     sizeof(double *));
+    for (i = 0; i < threadpool_size(); ++i)
+      job.scratch[i] = (double *)xmalloc((size_t)m * sizeof(double));
+  }
+
+  stats = stats_run(&job, col_count);
+
+  if (job.fft)
+  {
+    for (i = 0; i < threadpool_size(); ++i)
+      free(job.scratch[i]);
+    free(job.scratch);
+    fft_table_destroy(job.fft);
+  }
+
+  return stats;
+}
+
+/* same as stats_compute for the first records samples of each column, which
+   consist of run_count consecutive runs of lengths runs[i] that are already
+   sorted, e.g. datasets summarized with stats_compute. The runs are merged
+   in a single pass instead of sorting the columns. Tint is not computed */
+colstats_t * stats_compute_runs(double ** matrix,
+                                long records,
+                                long col_count,
+                                const long * runs,
+                                long run_count)
+{
+  stats_job_t job;
+
+  memset(&job, 0, sizeof(stats_job_t));
+  job.matrix = matrix;
+  job.records = records;
+  job.runs = runs;
+  job.run_count = run_count;
+
+  return stats_run(&job, col_count);
+}
+
+/* fill in the order statistics and HPD intervals of stats, for columns whose
+   records samples starting at sample start are already sorted. The mean,
+   standard deviation and tint in stats are left untouched */
+void stats_compute_sorted(double ** matrix,
+                          long start,
+                          long records,
+                          long col_count,
+                          colstats_t * stats)
+{
+  stats_job_t job;
+
+  memset(&job, 0, sizeof(stats_job_t));
+  job.matrix = matrix;
+  job.start = start;
+  job.records = records;
+  job.stats = stats;
+
+  report_start(PHASE_QUANTILES);
+  threadpool_run(col_count, cb_quantiles, &job);
+  report_stop(PHASE_QUANTILES);
+}
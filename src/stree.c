@@ -21,123 +21,174 @@
 
 #include "summarizer.h"
 
-static char * stree_export_newick_recursive(const snode_t * root,
-                                            char * (*cb_serialize)(const snode_t *))
+/* growable output buffer for newick export */
+typedef struct newick_buffer_s
 {
-  char * newick;
-  int size_alloced;
-  assert(root != NULL);
+  char * data;
+  size_t len;
+  size_t maxlen;
+} newick_buffer_t;
 
-  if (!(root->left) || !(root->right))
-  {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
-  }
-  else
-  {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (subtree1 == NULL)
-    {
-      return NULL;
-    }
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (subtree2 == NULL)
-    {
-      free(subtree1);
-      return NULL;
-    }
+static void newick_reserve(newick_buffer_t * buf, size_t len)
+{
+  if (buf->len + len + 1 <= buf->maxlen) return;
 
-    if (cb_serialize)
-    {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s",
-                               subtree1,
-                               subtree2,
-                               temp);
-      free(temp);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s:%f",
-                               subtree1,
-                               subtree2,
-                               root->label ? root->label : "",
-                               root->length);
-    }
-    free(subtree1);
-    free(subtree2);
-  }
-  if (size_alloced < 0)
-  {
+  while (buf->len + len + 1 > buf->maxlen)
+    buf->maxlen *= 2;
+  buf->data = (char *)xrealloc(buf->data, buf->maxlen);
+}
+
+static void newick_append(newick_buffer_t * buf, const char * s)
+{
+  size_t len = strlen(s);
+
+  newick_reserve(buf,len);
+  memcpy(buf->data + buf->len, s, len+1);
+  buf->len += len;
+}
+
+static void newick_printf(newick_buffer_t * buf, const char * format, ...)
+{
+  va_list ap;
+  int len;
+
+  va_start(ap,format);
+  len = vsnprintf(NULL, 0, format, ap);
+  va_end(ap);
+
+  if (len < 0)
     fatal("Memory allocation during newick export failed");
-  }
 
-  return newick;
+  newick_reserve(buf,(size_t)len);
+
+  va_start(ap,format);
+  vsnprintf(buf->data + buf->len, (size_t)len+1, format, ap);
+  va_end(ap);
+
+  buf->len += (size_t)len;
 }
 
+/* label and branch length of node, or the output of cb_serialize */
+static void newick_node(newick_buffer_t * buf,
+                        const snode_t * node,
+                        char * (*cb_serialize)(const snode_t *))
+{
+  if (cb_serialize)
+  {
+    char * temp = cb_serialize(node);
+    newick_append(buf,temp);
+    free(temp);
+  }
+  else
+    newick_printf(buf,
+                  "%s:%f",
+                  node->label ? node->label : "",
+                  node->length);
+}
+
+/* Write the newick representation of the tree rooted at root into a single
+   growable buffer. The tree is traversed iteratively with an explicit stack,
+   where each inner node is visited three times: before its left subtree,
+   between its two subtrees, and after its right subtree */
 char * stree_export_newick(const snode_t * root,
                            char * (*cb_serialize)(const snode_t *))
 {
-  char * newick;
-  int size_alloced;
+  newick_buffer_t buf;
+  long top = 0;
+  long maxdepth = 64;
+
   if (!root) return NULL;
 
-  if (!(root->left) || !(root->right))
+  buf.maxlen = 4096;
+  buf.len = 0;
+  buf.data = (char *)xmalloc(buf.maxlen);
+  buf.data[0] = 0;
+
+  /* a tree consisting of a single tip is written without semicolon */
+  if (!root->left || !root->right)
   {
-    if (cb_serialize)
-    {
-      newick = cb_serialize(root);
-      size_alloced = strlen(newick);
-    }
-    else
-    {
-      size_alloced = xasprintf(&newick, "%s:%f", root->label, root->length);
-    }
+    newick_node(&buf,root,cb_serialize);
+    return buf.data;
   }
-  else
+
+  const snode_t ** stack = (const snode_t **)xmalloc((size_t)maxdepth *
+                                                     sizeof(snode_t *));
+  int * visits = (int *)xmalloc((size_t)maxdepth * sizeof(int));
+
+  stack[0] = root;
+  visits[0] = 0;
+
+  while (top >= 0)
   {
-    char * subtree1 = stree_export_newick_recursive(root->left,cb_serialize);
-    if (!subtree1)
-      fatal("Unable to allocate enough memory.");
+    const snode_t * node = stack[top];
+    const snode_t * child = NULL;
 
-    char * subtree2 = stree_export_newick_recursive(root->right,cb_serialize);
-    if (!subtree2)
-      fatal("Unable to allocate enough memory.");
+    if (!node->left || !node->right)
+    {
+      newick_node(&buf,node,cb_serialize);
+      --top;
+      continue;
+    }
 
-    if (cb_serialize)
+    switch (visits[top]++)
     {
-      char * temp = cb_serialize(root);
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s;",
-                               subtree1,
-                               subtree2,
-                               temp);
-      free(temp);
+      case 0:
+        newick_append(&buf,"(");
+        child = node->left;
+        break;
+      case 1:
+        newick_append(&buf,", ");
+        child = node->right;
+        break;
+      default:
+        newick_append(&buf,")");
+        newick_node(&buf,node,cb_serialize);
+        --top;
+        break;
     }
-    else
+
+    if (child)
     {
-      size_alloced = xasprintf(&newick,
-                               "(%s, %s)%s:%f;",
-                               subtree1,
-                               subtree2,
-                               root->label ? root->label : "",
-                               root->length);
+      if (++top == maxdepth)
+      {
+        maxdepth *= 2;
+        stack = (const snode_t **)xrealloc(stack,
+                                           (size_t)maxdepth*sizeof(snode_t *));
+        visits = (int *)xrealloc(visits, (size_t)maxdepth * sizeof(int));
+      }
+      stack[top] = child;
+      visits[top] = 0;
     }
-    free(subtree1);
-    free(subtree2);
   }
-  if (size_alloced < 0)
-    fatal("memory allocation during newick export failed");
 
-  return newick;
+  newick_append(&buf,";");
+
+  free(stack);
+  free(visits);
+
+  return buf.data;
 }
 
+/* index the labeled nodes of tree by label, or only the inner nodes if
+   inner_only is set. Labels are copied, hence the index remains valid if
+   node labels are later modified. Duplicate labels are not allowed */
+hashtable_t * stree_label_index(const stree_t * tree, int inner_only)
+{
+  unsigned int i;
+  unsigned int first = inner_only ? tree->tip_count : 0;
+  unsigned int last = tree->tip_count + tree->inner_count;
+
+  hashtable_t * ht = hashtable_create(last - first);
+
+  for (i = first; i < last; ++i)
+  {
+    snode_t * node = tree->nodes[i];
+
+    if (!node->label) continue;
+
+    if (!hashtable_insert(ht, node->label, node))
+      fatal("Duplicate label %s in tree", node->label);
+  }
+
+  return ht;
+}
@@ -26,18 +26,33 @@ static char progheader[80];
 char * cmdline;
 
 /* options */
+long opt_approx;
+long opt_format;
 long opt_help;
+long opt_list;
 long opt_map_median;
 long opt_map_hpdci;
 long opt_quiet;
+long opt_shortest;
 long opt_skipcount;
+long opt_stats_report;
+long opt_burnin;
+long opt_thin;
+long opt_threads;
+long opt_validate;
 long opt_version;
+double opt_burnin_fraction;
+char * opt_cachefile;
+char * opt_columns;
 char * opt_combine;
 char * opt_indexfile;
 char * opt_mapfile;
+char * opt_merge;
 char * opt_output;
+char * opt_partial;
 char * opt_summarize;
 char * opt_treefile;
+char * opt_writecache;
 
 static struct option long_options[] =
 {
@@ -53,9 +68,43 @@ static struct option long_options[] =
   {"map",        required_argument, 0, 0 },  /*  9 */
   {"median",     no_argument,       0, 0 },  /* 10 */
   {"hpdci",      no_argument,       0, 0 },  /* 11 */
+  {"threads",    required_argument, 0, 0 },  /* 12 */
+  {"cache",      required_argument, 0, 0 },  /* 13 */
+  {"write-cache",required_argument, 0, 0 },  /* 14 */
+  {"columns",    required_argument, 0, 0 },  /* 15 */
+  {"burnin",     required_argument, 0, 0 },  /* 16 */
+  {"thin",       required_argument, 0, 0 },  /* 17 */
+  {"approx",     no_argument,       0, 0 },  /* 18 */
+  {"partial",    required_argument, 0, 0 },  /* 19 */
+  {"merge",      required_argument, 0, 0 },  /* 20 */
+  {"validate",   no_argument,       0, 0 },  /* 21 */
+  {"list",       no_argument,       0, 0 },  /* 22 */
+  {"shortest",   no_argument,       0, 0 },  /* 23 */
+  {"format",     required_argument, 0, 0 },  /* 24 */
+  {"stats-report",required_argument, 0, 0 },  /* 25 */
   { 0, 0, 0, 0 }
 };
 
+/* parse s as a whole into value. Returns 0 if s is empty, has trailing
+   characters or is out of range */
+static int parse_integer(const char * s, long * value)
+{
+  char * end;
+
+  errno = 0;
+  *value = strtol(s, &end, 10);
+  return end != s && !*end && errno != ERANGE;
+}
+
+static int parse_real(const char * s, double * value)
+{
+  char * end;
+
+  errno = 0;
+  *value = strtod(s, &end);
+  return end != s && !*end && errno != ERANGE;
+}
+
 void args_init(int argc, char ** argv)
 {
   int option_index = 0;
@@ -65,17 +114,32 @@ void args_init(int argc, char ** argv)
 
   progname = argv[0];
 
+  opt_cachefile = NULL;
+  opt_columns = NULL;
   opt_combine = NULL;
   opt_indexfile = NULL;
   opt_mapfile = NULL;
+  opt_merge = NULL;
   opt_output = NULL;
+  opt_partial = NULL;
   opt_summarize = NULL;
   opt_treefile = NULL;
+  opt_writecache = NULL;
+  opt_approx = 0;
   opt_help = 0;
+  opt_list = 0;
+  opt_shortest = 0;
+  opt_format = FORMAT_TEXT;
   opt_map_hpdci = 0;
   opt_map_median = 0;
   opt_quiet = 0;
   opt_skipcount = 1;
+  opt_stats_report = REPORT_NONE;
+  opt_burnin = 0;
+  opt_burnin_fraction = 0;
+  opt_thin = 1;
+  opt_threads = 1;
+  opt_validate = 0;
   opt_version = 0;
 
   while ((c = getopt_long_only(argc, argv, "", long_options, &option_index)) == 0)
@@ -107,8 +171,7 @@ void args_init(int argc, char ** argv)
         break;
 
       case 6:
-        opt_skipcount = atol(optarg);
-        if (opt_skipcount < 0)
+        if (!parse_integer(optarg, &opt_skipcount) || opt_skipcount < 0)
           fatal("option --skip requires a positive integer or 0");
         break;
 
@@ -132,6 +195,77 @@ void args_init(int argc, char ** argv)
         opt_map_hpdci = 1;
         break;
 
+      case 12:
+        if (!parse_integer(optarg, &opt_threads) || opt_threads < 1)
+          fatal("option --threads requires a positive integer");
+        break;
+
+      case 13:
+        opt_cachefile = xstrdup(optarg);
+        break;
+
+      case 14:
+        opt_writecache = xstrdup(optarg);
+        break;
+
+      case 15:
+        opt_columns = xstrdup(optarg);
+        break;
+
+      case 16:
+        /* a burn-in containing a decimal point is a fraction of samples */
+        if (strchr(optarg, '.'))
+        {
+          if (!parse_real(optarg, &opt_burnin_fraction) ||
+              opt_burnin_fraction < 0 || opt_burnin_fraction >= 1)
+            fatal("option --burnin requires a fraction in [0,1) or a "
+                  "non-negative integer");
+        }
+        else
+        {
+          if (!parse_integer(optarg, &opt_burnin) || opt_burnin < 0)
+            fatal("option --burnin requires a fraction in [0,1) or a "
+                  "non-negative integer");
+        }
+        break;
+
+      case 17:
+        if (!parse_integer(optarg, &opt_thin) || opt_thin < 1)
+          fatal("option --thin requires a positive integer");
+        break;
+
+      case 18:
+        opt_approx = 1;
+        break;
+
+      case 19:
+        opt_partial = xstrdup(optarg);
+        break;
+
+      case 20:
+        opt_merge = xstrdup(optarg);
+        break;
+
+      case 21:
+        opt_validate = 1;
+        break;
+
+      case 22:
+        opt_list = 1;
+        break;
+
+      case 23:
+        opt_shortest = 1;
+        break;
+
+      case 24:
+        opt_format = format_parse(optarg);
+        break;
+
+      case 25:
+        opt_stats_report = report_parse(optarg);
+        break;
+
       default:
         fatal("Internal error in option parsing");
     }
@@ -150,10 +284,14 @@ void args_init(int argc, char ** argv)
     commands++;
   if (opt_summarize)
     commands++;
+  if (opt_cachefile)
+    commands++;
   if (opt_combine)
     commands++;
   if (opt_mapfile)
     commands++;
+  if (opt_merge)
+    commands++;
 
   /* if more than one independent command, fail */
   if (commands > 1)
@@ -164,16 +302,54 @@ void args_init(int argc, char ** argv)
     opt_help = 1;
     return;
   }
+
+  if (opt_writecache && !opt_summarize)
+    fatal("Option --write-cache requires --summarize");
+
+  if (opt_approx && (!opt_summarize || opt_indexfile || opt_list ||
+                     opt_writecache))
+    fatal("Option --approx requires --summarize and cannot be used with "
+          "--index, --list or --write-cache");
+
+  if (opt_list && (!opt_summarize || opt_indexfile))
+    fatal("Option --list requires --summarize and cannot be used with "
+          "--index");
+
+  if (opt_validate && !opt_combine)
+    fatal("Option --validate requires --combine");
+
+  /* rows are combined verbatim and partial summaries are already filtered */
+  if ((opt_combine || opt_merge) &&
+      (opt_columns || opt_burnin || opt_burnin_fraction > 0 || opt_thin != 1))
+    fatal("Options --columns, --burnin and --thin cannot be used with "
+          "--combine or --merge");
+
+  if (opt_partial && (!opt_summarize || opt_indexfile || opt_list ||
+                      opt_approx))
+    fatal("Option --partial requires --summarize and cannot be used with "
+          "--index, --list or --approx");
+
+  if (opt_format != FORMAT_TEXT && !opt_summarize && !opt_cachefile &&
+      !opt_merge)
+    fatal("Option --format requires --summarize, --cache or --merge");
+
+  if (opt_format == FORMAT_BIN && !opt_output)
+    fatal("Option --format bin requires --output");
 }
 
 static void dealloc_switches()
 {
+  if (opt_cachefile) free(opt_cachefile);
+  if (opt_columns) free(opt_columns);
   if (opt_combine) free(opt_combine);
   if (opt_indexfile) free(opt_indexfile);
   if (opt_mapfile) free(opt_mapfile);
+  if (opt_merge) free(opt_merge);
   if (opt_output) free(opt_output);
+  if (opt_partial) free(opt_partial);
   if (opt_summarize) free(opt_summarize);
   if (opt_treefile) free(opt_treefile);
+  if (opt_writecache) free(opt_writecache);
 
 }
 
@@ -191,13 +367,28 @@ void cmd_help()
           "  --version             display version information\n"
           "  --quiet               only output warnings and fatal errors to stderr\n"
           "  --summarize FILENAME  summarize MCMC file\n"
+          "  --list                --summarize reads a list of MCMC files\n"
+          "  --cache FILENAME      summarize samples stored in cache file\n"
+          "  --write-cache FILENAME\n"
+          "                        store parsed samples in cache file\n"
           "  --combine FILENAME    combine list of MCMC files in specified file\n"
+          "  --partial FILENAME    store partial summary of MCMC file for --merge\n"
+          "  --merge FILENAME      merge list of partial summaries in specified file\n"
+          "  --validate            parse and reformat every value when combining\n"
           "  --output FILENAME     write output to specified file\n"
+          "  --shortest            print statistics in the shortest exact form\n"
+          "  --format FORMAT       summary format: text, csv, tsv, json or bin\n"
           "  --skip INTEGER        skip INTEGER lines from beginning of MCMC files\n"
-          "  --map FILENAME        map table summary to tree\n"
+          "  --map FILENAME        map table summary or MCMC samples to tree\n"
           "  --tree FILENAME       tree file in newick format\n"
           "  --median              use median instead of mean when mapping to tree\n"
           "  --hpdci               use HPD CI instead of equal-tail CI when mapping to tree\n"
+          "  --threads INTEGER     number of threads to use (default: 1)\n"
+          "  --columns PATTERNS    summarize only columns matching comma-separated globs\n"
+          "  --burnin NUMBER       discard NUMBER (or fraction) of samples per dataset\n"
+          "  --thin INTEGER        keep every INTEGER-th sample after burn-in\n"
+          "  --approx              summarize in bounded memory with approximate quantiles\n"
+          "  --stats-report FORMAT print time and memory per phase to stderr (text, json)\n"
           "\n"
          );
 
@@ -248,6 +439,10 @@ int main (int argc, char * argv[])
 
   show_header();
 
+  threadpool_init(opt_threads);
+
+  report_init();
+
   if (opt_help)
   {
     cmd_help();
@@ -258,7 +453,15 @@ int main (int argc, char * argv[])
   }
   else if (opt_summarize)
   {
-    if (opt_indexfile)
+    if (opt_indexfile || opt_list)
+      cmd_summary_full();
+    else
+      cmd_summary();
+  }
+  else if (opt_cachefile)
+  {
+    /* a cache written with an index file yields per-dataset summaries */
+    if (opt_indexfile || cache_dataset_count(opt_cachefile))
       cmd_summary_full();
     else
       cmd_summary();
@@ -271,6 +474,14 @@ int main (int argc, char * argv[])
   {
     cmd_map();
   }
+  else if (opt_merge)
+  {
+    cmd_merge();
+  }
+
+  report_print();
+
+  threadpool_destroy();
 
   dealloc_switches();
   free(cmdline);
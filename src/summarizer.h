@@ -33,9 +33,13 @@
 #include <math.h>
 #include <sys/stat.h>
 #include <stdint.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
 
 #ifndef _MSC_VER
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
@@ -88,6 +92,28 @@
 #define PROG_ARCH PROG_OS "_" PROG_CPU
 
 #define LINEALLOC 2048
+#define OUTBUF_SIZE (1024*1024)
+
+/* summary formats (--format) */
+#define FORMAT_TEXT 0
+#define FORMAT_CSV  1
+#define FORMAT_TSV  2
+#define FORMAT_JSON 3
+#define FORMAT_BIN  4
+
+/* report formats (--stats-report) */
+#define REPORT_NONE 0
+#define REPORT_TEXT 1
+#define REPORT_JSON 2
+
+/* phases timed for --stats-report */
+#define PHASE_COUNT     0
+#define PHASE_PARSE     1
+#define PHASE_MOMENTS   2
+#define PHASE_SORT      3
+#define PHASE_QUANTILES 4
+#define PHASE_OUTPUT    5
+#define PHASE_MAX       6
 
 /* structures and data types */
 
@@ -114,6 +140,18 @@ typedef struct snode_s
 
 } snode_t;
 
+typedef struct arena_s
+{
+  char ** blocks;
+  size_t block_count;
+  size_t block_maxcount;
+  size_t block_size;
+
+  /* free space in the current block */
+  char * ptr;
+  size_t avail;
+} arena_t;
+
 typedef struct stree_s
 {
   unsigned int tip_count;
@@ -123,8 +161,143 @@ typedef struct stree_s
   snode_t ** nodes;
 
   snode_t * root;
+
+  /* arena holding nodes and labels, or NULL if allocated individually */
+  arena_t * arena;
 } stree_t;
 
+typedef struct hashentry_s
+{
+  char * key;
+  void * value;
+} hashentry_t;
+
+typedef struct hashtable_s
+{
+  unsigned long table_size;
+  unsigned long entries_count;
+  unsigned long capacity;
+  hashentry_t * entries;
+} hashtable_t;
+
+typedef struct reader_s
+{
+  char * filename;
+  int fd;
+
+  /* memory-mapped file contents */
+  char * data;
+  size_t size;
+
+  /* current position and end of mapped region */
+  const char * pos;
+  const char * end;
+
+  long lineno;
+
+  /* data is mapped, otherwise it was read into memory */
+  int mapped;
+
+  /* zero-terminated copy of the current line for reader_getline */
+  char * line;
+  size_t line_maxsize;
+} reader_t;
+
+/* position within a reader, see reader_tell and reader_seek */
+typedef struct reader_pos_s
+{
+  size_t offset;
+  long lineno;
+} reader_pos_t;
+
+typedef struct outbuf_s
+{
+  FILE * fp;
+  const char * filename;
+  char * data;
+  size_t size;
+  size_t maxsize;
+} outbuf_t;
+
+typedef struct sketch_s
+{
+  long n;                       /* number of values summarized */
+  double mean;
+  double m2;                    /* sum of squared deviations from mean */
+  double min;
+  double max;
+
+  /* compactors; values at level h have weight 2^h */
+  long levels;
+  double ** level;
+  long * size;
+  long * maxsize;
+
+  double err;                   /* bound on absolute rank error */
+  uint64_t seed;
+} sketch_t;
+
+typedef struct samples_s
+{
+  long col_count;               /* number of columns excluding generation */
+  long sample_count;            /* number of samples (rows) */
+  char ** labels;               /* col_count+1 labels including generation */
+  double ** matrix;             /* column-major matrix of samples */
+
+  long dataset_count;           /* number of datasets in index file */
+  long * dataset_records_count; /* number of records per dataset */
+
+  void * cache_data;            /* mapped cache file holding the matrix */
+  size_t cache_size;
+
+  sketch_t ** sketches;         /* per-column sketches instead of matrix */
+} samples_t;
+
+typedef struct chunk_s
+{
+  /* region of the mapped file holding the chunk lines */
+  const char * start;
+  const char * end;
+
+  /* column segments parsed from the chunk, or per-column sketches */
+  double ** matrix;
+  sketch_t ** sketches;
+  long col_count;
+  long file_col_count;
+  const long * colmap;
+  long maxsamples;
+  long rows;
+  long limit;
+
+  /* number of lines in chunk and index of the first one in the file */
+  long lines;
+  long first_line;
+
+  /* burn-in and thinning */
+  const struct filter_s * filter;
+
+  /* index of first invalid line in chunk, or -1 */
+  long error_line;
+  int overflow;
+
+  int progress;
+  const char * progress_base;
+} chunk_t;
+
+typedef struct colstats_s
+{
+  double mean;
+  double stdev;
+  double median;
+  double min;
+  double max;
+  double q025;
+  double q975;
+  double hpd025;
+  double hpd975;
+  double tint;
+} colstats_t;
+
 /* macros */
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
@@ -146,18 +319,33 @@ typedef struct stree_s
 
 /* options */
 
+extern long opt_approx;
+extern long opt_format;
 extern long opt_help;
+extern long opt_list;
 extern long opt_quiet;
+extern long opt_shortest;
 extern long opt_skipcount;
+extern long opt_stats_report;
+extern long opt_burnin;
+extern long opt_thin;
+extern long opt_threads;
+extern long opt_validate;
 extern long opt_version;
 extern long opt_map_median;
 extern long opt_map_hpdci;
+extern double opt_burnin_fraction;
+extern char * opt_cachefile;
+extern char * opt_columns;
 extern char * opt_combine;
 extern char * opt_indexfile;
 extern char * opt_mapfile;
+extern char * opt_merge;
 extern char * opt_output;
+extern char * opt_partial;
 extern char * opt_summarize;
 extern char * opt_treefile;
+extern char * opt_writecache;
 
 /* functions in summary.c */
 
@@ -166,6 +354,7 @@ void cmd_summary(void);
 /* functions in summaryfull.c */
 
 void cmd_summary_full(void);
+void cmd_merge(void);
 
 /* functions in combine.c */
 
@@ -174,10 +363,12 @@ void cmd_combine(void);
 /* functions in util.c */
 
 #ifdef _MSC_VER
+int xvasprintf(char ** strp, const char * fmt, va_list ap);
 int xasprintf(char ** strp, const char * fmt, ...);
 __declspec(noreturn) void fatal(const char * format, ...);
 #else
 void fatal(const char * format, ...) __attribute__ ((noreturn));
+#define xvasprintf vasprintf
 #define xasprintf asprintf
 #endif
 void progress_init(const char * prompt, unsigned long size);
@@ -193,11 +384,17 @@ long getusec(void);
 FILE * xopen(const char * filename, const char * mode);
 void * pll_aligned_alloc(size_t size, size_t alignment);
 void pll_aligned_free(void * ptr);
+arena_t * arena_create(size_t block_size);
+void * arena_alloc(arena_t * a, size_t size);
+char * arena_strndup(arena_t * a, const char * s, size_t len);
+void arena_destroy(arena_t * a);
 
 /* functions in arch.c */
 
 unsigned long arch_get_memused(void);
 
+void arch_get_user_system_time(double * user_time, double * system_time);
+
 unsigned long arch_get_memtotal(void);
 
 long arch_get_cores(void);
@@ -207,21 +404,140 @@ long arch_get_cores(void);
 long get_long(const char * line, long * value);
 long get_double(const char * line, double * value, int * decplaces);
 long get_string(const char * line, char ** value);
-void reallocline(size_t newmaxsize);
-char * getnextline(FILE * fp);
 long count_columns(const char * line);
+reader_t * reader_open(const char * filename);
+void reader_close(reader_t * rd);
+const char * reader_nextline(reader_t * rd, size_t * len);
+char * reader_getline(reader_t * rd);
+void reader_tell(const reader_t * rd, reader_pos_t * pos);
+void reader_seek(reader_t * rd, const reader_pos_t * pos);
+long token_long(const char * s, const char * end, long * value);
+long token_skip(const char * s, const char * end);
+long token_double(const char * s,
+                  const char * end,
+                  double * value,
+                  int * decplaces);
+
+/* functions in samples.c */
+
+samples_t * samples_load(const char * filename,
+                         const char * indexfile,
+                         const char * columns,
+                         int filter);
+samples_t * samples_load_list(const char * listfile,
+                              const char * columns,
+                              int filter);
+samples_t * samples_get(const char * indexfile);
+void samples_destroy(samples_t * samples);
+
+/* functions in cache.c */
+
+void cache_write(const char * filename, const samples_t * samples);
+void cache_write_partial(const char * filename,
+                         const samples_t * samples,
+                         const colstats_t * stats);
+samples_t * cache_load(const char * filename);
+samples_t * cache_load_partial(const char * filename, colstats_t ** stats);
+long cache_dataset_count(const char * filename);
+
+/* functions in sort.c */
+
+void sort_double(double * x, long n);
+void merge_runs(double * x, const long * runs, long run_count);
+
+/* functions in threadpool.c */
+
+void threadpool_init(long thread_count);
+void threadpool_run(long task_count, void (*fn)(long, void *), void * data);
+long threadpool_size(void);
+long threadpool_worker(void);
+void threadpool_destroy(void);
+
+/* functions in stats.c */
+
+colstats_t * stats_compute(double ** matrix,
+                           long start,
+                           long records,
+                           long col_count,
+                           int ess);
+colstats_t * stats_compute_runs(double ** matrix,
+                                long records,
+                                long col_count,
+                                const long * runs,
+                                long run_count);
+void stats_compute_sorted(double ** matrix,
+                          long start,
+                          long records,
+                          long col_count,
+                          colstats_t * stats);
+
+/* functions in sketch.c */
+
+sketch_t * sketch_create(void);
+void sketch_destroy(sketch_t * s);
+void sketch_insert(sketch_t * s, double x);
+void sketch_merge(sketch_t * dst, const sketch_t * src);
+double sketch_error(const sketch_t * s);
+void sketch_stats(const sketch_t * s, colstats_t * st);
+
+/* functions in output.c */
+
+void outbuf_init(outbuf_t * buf, FILE * fp, const char * filename, size_t size);
+void outbuf_flush(outbuf_t * buf);
+void outbuf_free(outbuf_t * buf);
+void outbuf_write(outbuf_t * buf, const char * s, size_t len);
+void outbuf_string(outbuf_t * buf, const char * s);
+void outbuf_printf(outbuf_t * buf, const char * format, ...);
+void outbuf_long(outbuf_t * buf, long x);
+void outbuf_double(outbuf_t * buf, double x);
+void outbuf_exact(outbuf_t * buf, double x);
+void outbuf_column(outbuf_t * buf, double x);
+
+/* functions in format.c */
+
+long format_parse(const char * s);
+const char * format_extension(long format);
+void format_write(const char * filename,
+                  char ** labels,
+                  const colstats_t * stats,
+                  long col_count,
+                  long records,
+                  int ess);
+long format_detect(const char * filename);
+long format_load(const char * filename, char *** labels, colstats_t ** stats);
+
+/* functions in report.c */
+
+long report_parse(const char * s);
+void report_init(void);
+void report_start(int phase);
+void report_stop(int phase);
+void report_input(unsigned long bytes, long rows);
+void report_print(void);
 
 /* functions in parse_stree.y */
 
 void stree_destroy(stree_t * tree,
                    void (*cb_destroy)(void *));
-stree_t * stree_parse_newick(const char * filename);
 stree_t * stree_parse_newick_string(const char * s);
+stree_t * stree_wraptree(snode_t * root, unsigned int tip_count);
+
+/* functions in newick.c */
+
+stree_t * stree_parse_newick(const char * filename);
 
 /* functions in stree.c */
 
 char * stree_export_newick(const snode_t * root,
                            char * (*cb_serialize)(const snode_t *));
+hashtable_t * stree_label_index(const stree_t * tree, int inner_only);
+
+/* functions in hash.c */
+
+hashtable_t * hashtable_create(unsigned long items_count);
+void hashtable_destroy(hashtable_t * ht, void (*cb_destroy)(void *));
+int hashtable_insert(hashtable_t * ht, const char * key, void * value);
+void * hashtable_find(const hashtable_t * ht, const char * key);
 
 /* functions in map.c */
 
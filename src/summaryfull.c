@@ -21,375 +21,123 @@
 
 #include "summarizer.h"
 
-static char ** getlabels(const char * line)
-{
-  long columns = 0;
-  size_t count = 0;
-  size_t ws;
-  char * s = xstrdup(line);
-  char * p = s;
-  char * tmp;
-  char ** labels;
-
-
-  while (1)
-  {
-    count = get_string(p, &tmp);
-    if (!count) break;
-
-    p += count;
-
-    columns++;
-    free(tmp);
-
-    ws = strspn(p, " \t\r\n");
-    if (!ws) break;
-
-    p += ws;
-  }
-
-  labels = (char **)xmalloc((size_t)columns * sizeof(char *));
-  columns = 0;
-  p = s;
-  while (1)
-  {
-    count = get_string(p, &tmp);
-    if (!count) break;
-
-    p += count;
-
-    labels[columns++] = tmp;
-
-    ws = strspn(p, " \t\r\n");
-    if (!ws) break;
-
-    p += ws;
-  }
-
-  free(s);
-
-  return labels;
-}
-
-static long countindexrecords(long * dataset_records_count)
-{
-  long count;
-  long linelong = 0;
-  long line_count = 0;
-  long records = 0;
-  char * line;
-  char * p;
-  FILE * fp;
-
-  fp = xopen(opt_indexfile,"r");
-
-  while((line=getnextline(fp)))
-  {
-    ++line_count;
-    p = line;
-
-    count = get_long(p,&linelong);
-    if (!count)
-      fatal("Invalid entry in line %ld of %s", line_count, opt_indexfile);
-
-    if (linelong <= 0)
-      fatal("Invalid record on line %ld of %s", line_count, opt_indexfile);
-    dataset_records_count[line_count-1] = linelong;
-    records += linelong;
-  }
-
-  fclose(fp);
-
-  return records;
-}
-
-static long count_lines(const char * mcmcfile)
-{
-  FILE * fp;
-  long line_count = 0;
-
-  fp = xopen(mcmcfile,"r");
-
-  while(getnextline(fp))
-    ++line_count;
-
-  fclose(fp);
-
-  return line_count;
-}
-
-static int cb_cmp_double(const void * a, const void * b)
-{
-  double * x = (double *)a;
-  double * y = (double *)b;
-
-  return *x > *y;
-}
-
-#ifdef COMPUTE_ESS
-static double eff_ict(double * y, long n, double mean, double stdev)
-{
-  /* This calculates Efficiency or Tint using Geyer's (1992) initial positive
-     sequence method */
-
-  long i,j;
-  double tint = 1;
-  double rho, rho0 = 0;
-
-  /* TODO: ADDED NOW */
-  double * x = (double *)xmalloc((size_t)n * sizeof(double));
-  for (i = 0; i < n; ++i)
-    x[i] = (y[i]-mean)/stdev;
-
-
-  if (stdev/(fabs(mean)+1) < 1E-9)
-  {
-   tint = n;
-  }
-  else
-  {
-    for (i = 1; i < n-10; ++i)
-    {
-      rho = 0;
-      for (j = 0; j < n - i; ++j)
-        rho += x[j]*x[i+j];
-
-      rho /= (n-1);
-
-      if (i > 10 && rho+rho0 < 0)
-        break;
-
-      tint += rho*2;
-      rho0 = rho;
-    }
-  }
-
-  free(x);
-
-  return tint;
-}
-#endif
-
-static void hpd_interval(double * x,
-                         long n,
-                         double * ltail,
-                         double * rtail,
-                         double alpha)
-{
-  long lrow = (long)(n*alpha/2);
-  long urow = (long)(n*(1-alpha/2));
-  long diffrow = urow - lrow;
-  long l,r;
-
-  long left = lrow;
-  
-
-  double w = x[urow] - x[lrow];
-
-  *ltail = x[lrow];
-  *rtail = x[urow];
-
-  if (n <= 2) return;
-
-  for (l=0,r=l+diffrow; r < n; l++,r++)
-  {
-    if (x[r] - x[l] < w)
-    {
-      left = l;
-      w = x[r] - x[l];
-    }
-  }
-
-  *ltail = x[left];
-  *rtail = x[left + diffrow];
-}
-
-static void print_summary(long index,
-                          long start,
+static void write_summary(long index,
                           long records,
                           long col_count,
                           char ** labels,
-                          double ** matrix)
+                          const colstats_t * stats)
 {
-  long i,j;
+  long i;
   FILE * fp_out;
-
-  double * mean = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * medianarray = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  #ifdef COMPUTE_ESS
-  double * tint = (double *)xmalloc((size_t)col_count * sizeof(double));
-  #endif
-  double * stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
+  outbuf_t buf;
 
   char * s = NULL;
 
+  if (opt_format != FORMAT_TEXT)
+  {
+    if (index)
+      xasprintf(&s, "%s.%ld.%s", opt_output, index,
+                format_extension(opt_format));
+    else
+      xasprintf(&s, "%s.combined.%s", opt_output,
+                format_extension(opt_format));
+
+    if (index)
+      printf("Summarizing dataset %ld in %s\n", index, s);
+    else
+      printf("Summarizing combined dataset in %s\n", s);
+
+    format_write(s, labels+1, stats, col_count, records, 1);
+    free(s);
+    return;
+  }
+
   if (index)
     xasprintf(&s, "%s.%ld.txt", opt_output, index);
   else
     xasprintf(&s, "%s.combined.txt", opt_output);
 
   fp_out = xopen(s,"w");
+  outbuf_init(&buf, fp_out, s, OUTBUF_SIZE);
   if (index)
     printf("Summarizing dataset %ld in %s\n", index, s);
   else
     printf("Summarizing combined dataset in %s\n", s);
-  free(s);
-
 
-  fprintf(fp_out, "%s",labels[1]);
+  outbuf_string(&buf, labels[1]);
   for (i = 1; i < col_count; ++i)
-    fprintf(fp_out, " %s", labels[i+1]);
-  fprintf(fp_out,"\n");
-
-  /* compute means */
-  #if 0
-  printf("Computing means...\n");
-  #endif
-  fprintf(fp_out, "mean    ");
-  for (i = 0; i < col_count; ++i)
-  {
-    double sum = 0;
-    for (j = start; j < start+records; ++j)
-      sum += matrix[i][j];
+    outbuf_printf(&buf, " %s", labels[i+1]);
+  outbuf_string(&buf, "\n");
 
-    mean[i] = sum/records;
-    fprintf(fp_out, "  %f", mean[i]);
-  }
-  fprintf(fp_out, "\n");
-
-  /* compute standard deviation */
-  #if 0
-  printf("Computing stdev...\n");
-  #endif
+  /* print means */
+  outbuf_string(&buf, "mean    ");
   for (i = 0; i < col_count; ++i)
-  {
-    double sd = 0;
-    for (j = start; j < start+records; ++j)
-      sd += (matrix[i][j]-mean[i]) * (matrix[i][j]-mean[i]);
+    outbuf_column(&buf, stats[i].mean);
+  outbuf_string(&buf, "\n");
 
-    stdev[i] = sqrt(sd/(records-1));
-  }
-
-  #ifdef COMPUTE_ESS
-  /* compute tint */
-  #if 0
-  printf("Computing tint...\n");
-  #endif
+  /* print medians */
+  outbuf_string(&buf, "median  ");
   for (i = 0; i < col_count; ++i)
-    tint[i] = eff_ict(matrix[i]+start,records,mean[i],stdev[i]);
-  #endif
-
-  /* compute and print medians */
-  #if 0
-  printf("Computing medians...\n");
-  #endif
-  fprintf(fp_out, "median  ");
-  long median_line = records / 2;
-
-  for (i = 0; i < col_count; ++i)
-  {
-    qsort(matrix[i]+start, records, sizeof(double), cb_cmp_double);
-
-    double median = matrix[i][start+median_line];
-    if ((records & 1) == 0)
-    {
-      median += matrix[i][start+median_line-1];
-      median /= 2;
-    }
-
-    fprintf(fp_out, "  %f", median);
-    medianarray[i] = median;
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].median);
+  outbuf_string(&buf, "\n");
 
   /* print standard deviation */
-  #if 0
-  if (opt_output)
-    printf("Writing output to %s...\n", opt_output);
-  else
-    printf("Writing output...\n");
-  #endif
-
-  fprintf(fp_out, "S.D     ");
+  outbuf_string(&buf, "S.D     ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", stdev[i]);
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].stdev);
+  outbuf_string(&buf, "\n");
 
   /* print minimum values */
-  fprintf(fp_out, "min     ");
+  outbuf_string(&buf, "min     ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", matrix[i][start]);
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].min);
+  outbuf_string(&buf, "\n");
 
   /* print maximum values */
-  fprintf(fp_out, "max     ");
+  outbuf_string(&buf, "max     ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", matrix[i][start+records-1]);
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].max);
+  outbuf_string(&buf, "\n");
 
   /* print line at 2.5% of matrix */
-  fprintf(fp_out, "2.5%%    ");
+  outbuf_string(&buf, "2.5%    ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", matrix[i][start+(long)(records*.025)]);
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].q025);
+  outbuf_string(&buf, "\n");
 
   /* print line at 97.5% of matrix */
-  fprintf(fp_out, "97.5%%   ");
+  outbuf_string(&buf, "97.5%   ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", matrix[i][start+(long)(records*.975)]);
-  }
-  fprintf(fp_out, "\n");
-
-  /* compute and print HPD 2.5% and 97.5% */
-  for (i = 0; i < col_count; ++i)
-    hpd_interval(matrix[i]+start,records,hpd025+i,hpd975+i,0.05);
+    outbuf_column(&buf, stats[i].q975);
+  outbuf_string(&buf, "\n");
 
   /* print 2.5% HPD */
-  fprintf(fp_out, "2.5%%HPD ");
+  outbuf_string(&buf, "2.5%HPD ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", hpd025[i]);
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].hpd025);
+  outbuf_string(&buf, "\n");
 
   /* print 97.5% HPD */
-  fprintf(fp_out, "97.5%%HPD");
+  outbuf_string(&buf, "97.5%HPD");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", hpd975[i]);
-  }
-  fprintf(fp_out, "\n");
+    outbuf_column(&buf, stats[i].hpd975);
+  outbuf_string(&buf, "\n");
 
-  #ifdef COMPUTE_ESS
   /* print ESS */
-  fprintf(fp_out, "ESS*    ");
+  outbuf_string(&buf, "ESS*    ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", records/tint[i]);
-  }
-  fprintf(fp_out, "\n");
-    
+    outbuf_column(&buf, records/stats[i].tint);
+  outbuf_string(&buf, "\n");
+
   /* print Eff */
-  fprintf(fp_out, "Eff*    ");
+  outbuf_string(&buf, "Eff*    ");
   for (i = 0; i < col_count; ++i)
-  {
-    fprintf(fp_out, "  %f", 1/tint[i]);
-  }
-  fprintf(fp_out, "\n");
-  #endif
+    outbuf_column(&buf, 1/stats[i].tint);
+  outbuf_string(&buf, "\n");
 
+  outbuf_free(&buf);
   fclose(fp_out);
+  free(s);
 
   s = NULL;
   if (index)
@@ -398,181 +146,218 @@ static void print_summary(long index,
     xasprintf(&s, "%s.table.combined.txt", opt_output);
 
   fp_out = xopen(s,"w");
+  outbuf_init(&buf, fp_out, s, OUTBUF_SIZE);
   printf("Table-like summary in %s\n", s);
-  free(s);
 
   /* table-like summary */
-  fprintf(fp_out, "Posterior median mean (95%% Equal-tail CI) (95%% HPD CI) HPD-CI-width\n");
+  outbuf_string(&buf, "Posterior median mean (95% Equal-tail CI) (95% HPD CI) HPD-CI-width\n");
   for (i = 0; i < col_count; ++i)
   {
-    fprintf(fp_out, "%-15s ", labels[i+1]);
-    fprintf(fp_out, "%f ",medianarray[i]);
-    fprintf(fp_out, "%f ",mean[i]);
-    fprintf(fp_out, "(%f, %f) ", matrix[i][start+(long)(records*.025)],
-                                 matrix[i][start+(long)(records*.975)]);
-    fprintf(fp_out, "(%f, %f) ", hpd025[i], hpd975[i]);
-    fprintf(fp_out, "%f\n", hpd975[i] - hpd025[i]);
+    outbuf_printf(&buf, "%-15s ", labels[i+1]);
+    outbuf_double(&buf, stats[i].median);
+    outbuf_string(&buf, " ");
+    outbuf_double(&buf, stats[i].mean);
+    outbuf_string(&buf, " (");
+    outbuf_double(&buf, stats[i].q025);
+    outbuf_string(&buf, ", ");
+    outbuf_double(&buf, stats[i].q975);
+    outbuf_string(&buf, ") (");
+    outbuf_double(&buf, stats[i].hpd025);
+    outbuf_string(&buf, ", ");
+    outbuf_double(&buf, stats[i].hpd975);
+    outbuf_string(&buf, ") ");
+    outbuf_double(&buf, stats[i].hpd975 - stats[i].hpd025);
+    outbuf_string(&buf, "\n");
   }
 
-  free(mean);
-  free(medianarray);
-  free(hpd025);
-  free(hpd975);
-  #ifdef COMPUTE_ESS
-  free(tint);
-  #endif
-  free(stdev);
-
+  outbuf_free(&buf);
   fclose(fp_out);
+  free(s);
+}
+
+static void print_summary(long index,
+                          long records,
+                          long col_count,
+                          char ** labels,
+                          const colstats_t * stats)
+{
+  report_start(PHASE_OUTPUT);
+  write_summary(index, records, col_count, labels, stats);
+  report_stop(PHASE_OUTPUT);
 }
 
 void cmd_summary_full()
 {
-  FILE * fp;
-  long i;
-  long count;
-  long opt_samples;
-  long sample_num;
-  long line_count = 0;
-  long dataset_count = 0;
-  char * line;
-  FILE * fp_out;
-  long * dataset_records_count = NULL;
+  long i,j;
+  colstats_t * stats;
 
   if (opt_skipcount < 1)
     fatal("Option --skip must be greater or equal to 1");
 
-  opt_samples = count_lines(opt_summarize);
-  dataset_count = count_lines(opt_indexfile);
+  samples_t * samples = samples_get(opt_indexfile);
+  long col_count = samples->col_count;
 
-  printf("Reading records...\n");
+  /* sum of records*tint over datasets. The datasets are independent chains,
+     hence the variance of the combined mean gives a combined tint equal to
+     the average of the dataset tints weighted by their number of records.
+     This must be accumulated here, since the datasets are sorted in place,
+     and their sorted runs are then merged for the combined summary */
+  double * tint_sum = (double *)xcalloc((size_t)col_count, sizeof(double));
 
-  dataset_records_count = (long *)xcalloc(dataset_count,sizeof(long));
-  long total_records_count = countindexrecords(dataset_records_count);
-
-  if (opt_samples-opt_skipcount != total_records_count)
-    fatal("Number of records in %s does not match with index file %s",
-          opt_summarize, opt_indexfile);
+  /* print individual dataset summaries */
+  long start = 0;
+  for (i = 0; i < samples->dataset_count; ++i)
+  {
+    long records = samples->dataset_records_count[i];
 
-  /* skip header */
-  opt_samples -= 1;
+    stats = stats_compute(samples->matrix, start, records, col_count, 1);
+    for (j = 0; j < col_count; ++j)
+      tint_sum[j] += records * stats[j].tint;
 
-  fp = xopen(opt_summarize,"r");
+    print_summary(i+1, records, col_count, samples->labels, stats);
+    free(stats);
 
-  if (opt_output)
-    fp_out = xopen(opt_output,"w");
-  else
-    fp_out = stdout;
+    start += records;
+  }
 
-  /* skip line containing header */
-  line = getnextline(fp);
+  /* print combined summary */
+  printf("Summarizing combined dataset...\n");
+  stats = stats_compute_runs(samples->matrix,
+                             samples->sample_count,
+                             col_count,
+                             samples->dataset_records_count,
+                             samples->dataset_count);
+  for (j = 0; j < col_count; ++j)
+    stats[j].tint = tint_sum[j] / samples->sample_count;
+
+  print_summary(0, samples->sample_count, col_count, samples->labels, stats);
+
+  free(stats);
+  free(tint_sum);
+  samples_destroy(samples);
+}
 
-  /* compute number of columns in the file */
+/* merge the partial summaries listed in file opt_merge, each written with
+   --summarize and --partial for one chain. The per-dataset and combined
+   summaries are identical to those of --summarize with --index on the file
+   obtained by combining the chains with --combine */
+void cmd_merge()
+{
+  long i,j;
+  long dataset_count = 0;
+  long maxcount = 16;
   long col_count = 0;
+  long sample_count = 0;
+  char * line;
+  reader_t * rd;
 
-  col_count = count_columns(line);
-  char ** labels = getlabels(line);
-
-  /* subtract generations */
-  col_count--;
-
-  for (i = 1; i < opt_skipcount; ++i)
-    line = getnextline(fp);
+  if (!opt_output)
+    fatal("Option --merge requires an output file via --output");
 
+  rd = reader_open(opt_merge);
 
-  fprintf(stdout, "Skipped %ld header line(s)...\n", opt_skipcount);
-  fprintf(stdout, "Processing %ld lines (samples) each %ld columns...\n",
-          opt_samples, col_count);
+  char ** filenames = (char **)xmalloc((size_t)maxcount * sizeof(char *));
+  while ((line=reader_getline(rd)))
+  {
+    line[strcspn(line,"\r\n")] = 0;
+    if (!*line) continue;
 
-  double ** matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
-  for (i = 0; i < col_count; ++i)
-    matrix[i] = (double *)xmalloc((size_t)opt_samples * sizeof(double));
+    if (dataset_count == maxcount)
+    {
+      maxcount *= 2;
+      filenames = (char **)xrealloc(filenames,
+                                    (size_t)maxcount * sizeof(char *));
+    }
+    filenames[dataset_count++] = xstrdup(line);
+  }
+  reader_close(rd);
 
-  double * mean = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * hpd025 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  double * hpd975 = (double *)xmalloc((size_t)col_count * sizeof(double));
-  #ifdef COMPUTE_ESS
-  double * tint = (double *)xmalloc((size_t)col_count * sizeof(double));
-  #endif
-  double * stdev = (double *)xmalloc((size_t)col_count * sizeof(double));
+  if (!dataset_count)
+    fatal("File %s contains no partial summaries", opt_merge);
 
-  unsigned long total_steps = opt_samples;
-  progress_init("Processing data...", total_steps);
+  samples_t ** parts = (samples_t **)xmalloc((size_t)dataset_count *
+                                             sizeof(samples_t *));
+  long * records = (long *)xmalloc((size_t)dataset_count * sizeof(long));
+  double * tint_sum = NULL;
 
-  while((line=getnextline(fp)))
+  /* print individual dataset summaries. Columns are already sorted and the
+     moments were computed on the original order of samples */
+  for (i = 0; i < dataset_count; ++i)
   {
-    double x;
-    char * p = line;
-
-    progress_update(line_count);
+    colstats_t * stats;
 
-    /* skip sample number */
-    count = get_long(p,&sample_num);
-    if (!count) goto l_unwind;
+    report_start(PHASE_PARSE);
+    parts[i] = cache_load_partial(filenames[i], &stats);
+    report_stop(PHASE_PARSE);
+    report_input(parts[i]->cache_size, parts[i]->sample_count);
 
-    p += count;
-
-    /* read remaining elements of current row */
-
-    for (i = 0; i < col_count; ++i)
+    if (!i)
+    {
+      col_count = parts[0]->col_count;
+      tint_sum = (double *)xcalloc((size_t)col_count, sizeof(double));
+    }
+    else
     {
-      count = get_double(p,&x,NULL);
-      if (!count) goto l_unwind;
+      if (parts[i]->col_count != col_count)
+        fatal("Partial summary %s contains %ld columns instead of %ld",
+              filenames[i], parts[i]->col_count, col_count);
+
+      for (j = 0; j < col_count+1; ++j)
+        if (strcmp(parts[i]->labels[j], parts[0]->labels[j]))
+          fatal("Column %ld of partial summary %s is labelled %s instead of %s",
+                j, filenames[i], parts[i]->labels[j], parts[0]->labels[j]);
+    }
 
-      p += count;
+    records[i] = parts[i]->sample_count;
+    sample_count += records[i];
 
-      matrix[i][line_count] = x;
-    }
+    stats_compute_sorted(parts[i]->matrix, 0, records[i], col_count, stats);
+    for (j = 0; j < col_count; ++j)
+      tint_sum[j] += records[i] * stats[j].tint;
 
-    line_count++;
+    print_summary(i+1, records[i], col_count, parts[i]->labels, stats);
+    free(stats);
   }
-  progress_done();
 
-  /* print individual dataset summaries */
-  long start = 0;
-  for (i = 0; i < dataset_count; ++i)
+  /* concatenate the sorted runs of each column as in cmd_summary_full */
+  double ** matrix = (double **)xmalloc((size_t)col_count * sizeof(double *));
+  for (j = 0; j < col_count; ++j)
   {
-    print_summary(i+1,
-                  start,
-                  dataset_records_count[i],
-                  col_count,
-                  labels,
-                  matrix);
-
-    start += dataset_records_count[i];
+    long offset = 0;
+
+    matrix[j] = (double *)xmalloc((size_t)sample_count * sizeof(double));
+    for (i = 0; i < dataset_count; ++i)
+    {
+      memcpy(matrix[j]+offset,
+             parts[i]->matrix[j],
+             (size_t)records[i] * sizeof(double));
+      offset += records[i];
+    }
   }
 
   /* print combined summary */
   printf("Summarizing combined dataset...\n");
-  print_summary(0,
-                0,
-                opt_samples,
-                col_count,
-                labels,
-                matrix);
-
-l_unwind:
-  for (i = 0; i < col_count+1; ++i)
-    free(labels[i]);
-  free(labels);
-
-  if (dataset_records_count)
-    free(dataset_records_count);
-
-  for (i = 0; i < col_count; ++i)
-    free(matrix[i]);
+  colstats_t * stats = stats_compute_runs(matrix,
+                                          sample_count,
+                                          col_count,
+                                          records,
+                                          dataset_count);
+  for (j = 0; j < col_count; ++j)
+    stats[j].tint = tint_sum[j] / sample_count;
+
+  print_summary(0, sample_count, col_count, parts[0]->labels, stats);
+
+  free(stats);
+  for (j = 0; j < col_count; ++j)
+    free(matrix[j]);
   free(matrix);
-
-  free(mean);
-  free(hpd025);
-  free(hpd975);
-  #ifdef COMPUTE_ESS
-  free(tint);
-  #endif
-  free(stdev);
-
-  if (opt_output)
-    fclose(fp_out);
-
-  fclose(fp);
+  for (i = 0; i < dataset_count; ++i)
+  {
+    samples_destroy(parts[i]);
+    free(filenames[i]);
+  }
+  free(parts);
+  free(filenames);
+  free(records);
+  free(tint_sum);
 }
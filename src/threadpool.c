@@ -0,0 +1,188 @@
+/*
+    Copyright (C) 2018 Tomas Flouri
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact: Tomas Flouri <t.flouris@ucl.ac.uk>,
+    Department of Genetics, Evolution and Environment,
+    University College London, Gower Street, London WC1E 6BT, United Kingdom
+*/
+
+#include "summarizer.h"
+
+/* Persistent pool of worker threads. Each call to threadpool_run() hands out
+   tasks 0..task_count-1 dynamically: every thread, including the calling
+   one, repeatedly claims the next unprocessed task from a shared counter.
+   This balances the load when the cost of tasks varies */
+
+static pthread_t * workers = NULL;
+static long * worker_ids = NULL;
+static long worker_count = 0;
+
+/* index of the pool thread running the current task (see threadpool_worker) */
+static pthread_key_t worker_key;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+
+/* current job */
+static void (*job_fn)(long, void *);
+static void * job_data;
+static long job_tasks;
+static long job_next;
+static long job_generation = 0;
+static long job_active = 0;
+static int pool_exit = 0;
+
+static void process_tasks(void)
+{
+  long task;
+
+  while ((task = __sync_fetch_and_add(&job_next, 1)) < job_tasks)
+    job_fn(task, job_data);
+}
+
+static void * worker(void * arg)
+{
+  long generation = 0;
+
+  pthread_setspecific(worker_key, arg);
+
+  while (1)
+  {
+    pthread_mutex_lock(&pool_mutex);
+    while (generation == job_generation && !pool_exit)
+      pthread_cond_wait(&pool_start, &pool_mutex);
+
+    if (pool_exit)
+    {
+      pthread_mutex_unlock(&pool_mutex);
+      break;
+    }
+
+    generation = job_generation;
+    pthread_mutex_unlock(&pool_mutex);
+
+    process_tasks();
+
+    pthread_mutex_lock(&pool_mutex);
+    if (--job_active == 0)
+      pthread_cond_signal(&pool_done);
+    pthread_mutex_unlock(&pool_mutex);
+  }
+
+  return NULL;
+}
+
+void threadpool_init(long thread_count)
+{
+  long i;
+
+  assert(!workers);
+
+  /* the calling thread also processes tasks */
+  worker_count = thread_count - 1;
+  if (worker_count <= 0)
+  {
+    worker_count = 0;
+    return;
+  }
+
+  if (pthread_key_create(&worker_key, NULL))
+    fatal("Unable to create thread key");
+
+  pool_exit = 0;
+  workers = (pthread_t *)xmalloc((size_t)worker_count * sizeof(pthread_t));
+  worker_ids = (long *)xmalloc((size_t)worker_count * sizeof(long));
+  for (i = 0; i < worker_count; ++i)
+  {
+    /* the calling thread is 0 */
+    worker_ids[i] = i+1;
+    if (pthread_create(workers+i, NULL, worker, (void *)(worker_ids+i)))
+      fatal("Unable to create thread");
+  }
+}
+
+/* number of threads that process tasks, including the calling thread */
+long threadpool_size(void)
+{
+  return worker_count+1;
+}
+
+/* index in 0..threadpool_size()-1 of the thread running the current task.
+   Used by tasks to pick per-thread scratch space */
+long threadpool_worker(void)
+{
+  long * id;
+
+  if (!workers) return 0;
+
+  id = (long *)pthread_getspecific(worker_key);
+  return id ? *id : 0;
+}
+
+void threadpool_run(long task_count, void (*fn)(long, void *), void * data)
+{
+  long i;
+
+  if (!worker_count)
+  {
+    for (i = 0; i < task_count; ++i)
+      fn(i,data);
+    return;
+  }
+
+  pthread_mutex_lock(&pool_mutex);
+  job_fn = fn;
+  job_data = data;
+  job_tasks = task_count;
+  job_next = 0;
+  job_active = worker_count;
+  job_generation++;
+  pthread_cond_broadcast(&pool_start);
+  pthread_mutex_unlock(&pool_mutex);
+
+  process_tasks();
+
+  /* wait until all workers have finished their last task */
+  pthread_mutex_lock(&pool_mutex);
+  while (job_active)
+    pthread_cond_wait(&pool_done, &pool_mutex);
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+void threadpool_destroy(void)
+{
+  long i;
+
+  if (!workers) return;
+
+  pthread_mutex_lock(&pool_mutex);
+  pool_exit = 1;
+  pthread_cond_broadcast(&pool_start);
+  pthread_mutex_unlock(&pool_mutex);
+
+  for (i = 0; i < worker_count; ++i)
+    if (pthread_join(workers[i], NULL))
+      fatal("Unable to join thread");
+
+  pthread_key_delete(worker_key);
+
+  free(workers);
+  free(worker_ids);
+  workers = NULL;
+  worker_ids = NULL;
+  worker_count = 0;
+}
@@ -122,14 +122,12 @@ char * xstrndup(const char * s, size_t len)
   return p;
 }
 
-#if 0
 long getusec(void)
 {
   struct timeval tv;
   if(gettimeofday(&tv,0) != 0) return 0;
   return tv.tv_sec * 1000000 + tv.tv_usec;
 }
-#endif
 
 FILE * xopen(const char * filename, const char * mode)
 {
@@ -163,10 +161,72 @@ void pll_aligned_free(void * ptr)
 #endif
 }
 
+/* Arena allocator for many small objects that are freed together. Memory
+   is handed out from large zero-initialized blocks and only released when
+   the arena is destroyed */
+arena_t * arena_create(size_t block_size)
+{
+  arena_t * a = (arena_t *)xcalloc(1,sizeof(arena_t));
+
+  a->block_size = block_size;
+
+  return a;
+}
+
+void * arena_alloc(arena_t * a, size_t size)
+{
+  /* keep allocations aligned for any object type */
+  size = (size + 15) & ~(size_t)15;
+
+  if (size > a->avail)
+  {
+    size_t block_size = MAX(a->block_size, size);
+
+    if (a->block_count == a->block_maxcount)
+    {
+      a->block_maxcount = a->block_maxcount ? 2*a->block_maxcount : 16;
+      a->blocks = (char **)xrealloc(a->blocks,
+                                    a->block_maxcount * sizeof(char *));
+    }
+    a->ptr = a->blocks[a->block_count++] = (char *)xcalloc(1,block_size);
+    a->avail = block_size;
+  }
+
+  void * mem = a->ptr;
+  a->ptr += size;
+  a->avail -= size;
+
+  return mem;
+}
+
+char * arena_strndup(arena_t * a, const char * s, size_t len)
+{
+  char * p = (char *)arena_alloc(a, len+1);
+
+  memcpy(p,s,len);
+  p[len] = 0;
+
+  return p;
+}
+
+void arena_destroy(arena_t * a)
+{
+  size_t i;
+
+  for (i = 0; i < a->block_count; ++i)
+    free(a->blocks[i]);
+  free(a->blocks);
+  free(a);
+}
+
 #ifdef _MSC_VER
-static int xvasprintf(char **strp, const char *fmt, va_list ap)
+int xvasprintf(char **strp, const char *fmt, va_list ap)
 {
-  int len = _vscprintf(fmt, ap);
+  /* ap is traversed twice */
+  va_list aq;
+  va_copy(aq, ap);
+  int len = _vscprintf(fmt, aq);
+  va_end(aq);
   if (len == -1) return -1;
 
   size_t size = (size_t)len+1;